@@ -28,659 +28,9078 @@ etc.
 */
 
 
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define INTERVAL_HAVE_AVX2 1
+#define INTERVAL_HAVE_RDTSC 1
+#endif
 
 #define SHOULD_PRINT 1
 #define SHOULD_NOT_PRINT 0
 
+#define INTERVAL_BACKEND_LIST 0
+#define INTERVAL_BACKEND_ARRAY 1
+#define INTERVAL_BACKEND_BLOCK 2
+#define INTERVAL_BACKEND_HYBRID 3
+
+#define INTERVAL_OP_ADD 'A'
+#define INTERVAL_OP_REMOVE 'R'
+
+#define INTERVAL_RADIX_BITS 8
+#define INTERVAL_RADIX_BUCKETS ( 1 << INTERVAL_RADIX_BITS )
+
+/*
+        Parallel work gets a thread per online core ( or INTERVAL_THREADS,
+        if defined ), each with at least INTERVAL_MIN_PER_THREAD items. The
+        tests define both to run the parallel paths on small inputs.
+ */
+
+#define INTERVAL_MAX_THREADS 64
+
+#ifndef INTERVAL_MIN_PER_THREAD
+#define INTERVAL_MIN_PER_THREAD 65536
+#endif
+
+/*
+        Truth tables for combining two sets, indexed by 
+        ( inFirst * 2 + inSecond ) for a point.
+ */
+
+#define INTERVAL_COMBINE_UNION 0xE
+#define INTERVAL_COMBINE_INTERSECT 0x8
+#define INTERVAL_COMBINE_DIFFERENCE 0x4
+#define INTERVAL_COMBINE_COMPLEMENT 0x2
+
+#define INTERVAL_CHANGE_INSERT '+'
+#define INTERVAL_CHANGE_DELETE '-'
+#define INTERVAL_CHANGE_RESIZE '~'
+
+#define INTERVAL_REPLAY_CHUNK ( 1 << 20 )
+
+#define INTERVAL_IMAGE_MAGIC "INTVSNP1"
+#define INTERVAL_IMAGE_VERSION 1
+#define INTERVAL_LOG_BUFFER 256
+
+#define INTERVAL_SHARED_MAGIC "INTVSHM1"
+#define INTERVAL_SHARED_VERSION 1
+
+#define INTERVAL_BENCH_SUB_BITS 4
+#define INTERVAL_BENCH_BUCKETS ( 64 << INTERVAL_BENCH_SUB_BITS )
+#define INTERVAL_BENCH_ZIPF_REGIONS 1024
+
+/*
+        The largest benchmark key space. Workloads reach up to a sixteenth
+        of the key space ( plus an interval ) past its end, which must not
+        overflow an int.
+ */
+
+#define INTERVAL_BENCH_MAX_KEYSPACE ( ( int ) ( ( INT32_MAX - 64 ) / 17ll * 16 ) )
+
+#define INTERVAL_MAX_READERS 64
+#define INTERVAL_CACHE_LINE 64
+
+#define INTERVAL_SLAB_MIN_NODES 32
+#define INTERVAL_SLAB_MAX_NODES 4096
+
+#define INTERVAL_BLOCK_INTERVALS 64
+#define INTERVAL_BLOCK_MAX_BYTES ( 2 * INTERVAL_BLOCK_INTERVALS * 5 )
+
+#define INTERVAL_CHUNK_BITS 16
+#define INTERVAL_CHUNK_SIZE ( 1 << INTERVAL_CHUNK_BITS )
+#define INTERVAL_CHUNK_WORDS ( INTERVAL_CHUNK_SIZE / 64 )
+#define INTERVAL_CHUNK_MAX_RUNS 1024
+#define INTERVAL_CHUNK_MIN_RUNS 256
+
 typedef struct INTERVAL
 {
         int                     left;
         int                     right;
         struct INTERVAL*        next;
         struct INTERVAL*        prev;
+        struct INTERVAL*        parent;
+        struct INTERVAL*        lchild;
+        struct INTERVAL*        rchild;
+        unsigned int            priority;
+        unsigned int            size;
+        int64_t                 length;
 } interval_t;
 
+/*
+        Nodes are not allocated one by one. Each set owns a chain of slabs
+        ( contiguous blocks of nodes, doubling in size up to a cap ) that 
+        works as an arena: nodes are handed out of the slab at the cursor,
+        moving on to the next slab ( or a new one ) when it is used up, and
+        deleted nodes are kept on a free list ( linked through 'next' ) and
+        recycled first. Clearing the set just moves the cursor back to the
+        first slab, whose 'used' is reset, and the slabs after it are reset 
+        as the cursor reaches them again.
+ */
+
+typedef struct INTERVAL_SLAB
+{
+        struct INTERVAL_SLAB*   next;
+        size_t                  capacity;
+        size_t                  used;
+        interval_t              nodes[];
+} interval_slab_t;
+
+/*
+        The array backend stores the set as two parallel sorted arrays,
+        one of left values and one of right values. Lookups are binary 
+        searches and merges or splits shift the tail of both arrays.
+ */
+
+typedef struct
+{
+        int*            lefts;
+        int*            rights;
+        size_t          count;
+        size_t          capacity;
+} interval_array_t;
+
+/*
+        The block backend stores the set compressed, in blocks of up to
+        INTERVAL_BLOCK_INTERVALS intervals. A block keeps the left value of
+        its first interval in the clear ( the block index, which is binary
+        searched ) and encodes the rest as varints: the length of the first
+        interval, then for every following one the gap since the previous 
+        interval and its length. An operation only decodes and rewrites the
+        blocks it touches.
+ */
+
+typedef struct
+{
+        int             first;
+        uint32_t        count;
+        uint32_t        size;
+        unsigned char*  data;
+} interval_block_t;
+
+typedef struct
+{
+        interval_block_t*       blocks;
+        size_t                  count;
+        size_t                  capacity;
+        size_t                  intervals;
+} interval_blocks_t;
+
+/*
+        The hybrid backend splits the key space into chunks of 
+        INTERVAL_CHUNK_SIZE values ( keyed on the upper bits of the value,
+        with the sign bit flipped so that keys sort like values ), kept in
+        a sorted array of the chunks that are not empty. A chunk holds its
+        part of the set either as runs ( a sorted interval array in chunk 
+        coordinates, 0 to INTERVAL_CHUNK_SIZE ) or, once it has more than
+        INTERVAL_CHUNK_MAX_RUNS of them, as a bitmap of the same size as 
+        that many runs. A bitmap goes back to runs when it falls below 
+        INTERVAL_CHUNK_MIN_RUNS, so a chunk near the limit doesn't flip back 
+        and forth. Chunks that are completely full hold neither: an entry 
+        with a 'span' stands for that many consecutive full chunks from 'key'
+        on, so a range covering many chunks costs one entry. Full chunks are
+        always kept in spans, and adjacent spans are merged.
+ */
+
+typedef struct
+{
+        int                     key;
+        int                     span;
+        int                     runs;
+        uint64_t*               bitmap;
+        interval_array_t        array;
+} interval_chunk_t;
+
+typedef struct
+{
+        interval_chunk_t*       chunks;
+        size_t                  count;
+        size_t                  capacity;
+} interval_chunks_t;
+
+/*
+        Reads the intervals of one block in order.
+ */
+
+typedef struct
+{
+        const interval_block_t*         block;
+        const unsigned char*            p;
+        uint32_t                        index;
+        int                             right;
+} interval_block_cursor_t;
+
+/*
+        Hot path counters, compiled in only when INTERVAL_STATS is defined
+        ( e.g. gcc -DINTERVAL_STATS ... ). 'cases' counts which branch of 
+        the list backend's add and remove each operation took, 'traversed'
+        the treap nodes visited on the way down, and 'cycles' is a log2 
+        histogram of the time stamp counter ( or nanoseconds where there is
+        none ) spent in each add and remove, on either backend.
+ */
+
+enum
+{
+        INTERVAL_STAT_ADD_HEAD,
+        INTERVAL_STAT_ADD_TAIL,
+        INTERVAL_STAT_ADD_BOTH,
+        INTERVAL_STAT_ADD_RIGHT,
+        INTERVAL_STAT_ADD_LEFT,
+        INTERVAL_STAT_ADD_CASE1,
+        INTERVAL_STAT_ADD_CASE2,
+        INTERVAL_STAT_ADD_CASE3,
+        INTERVAL_STAT_ADD_CASE4,
+        INTERVAL_STAT_ADD_INSIDE,
+        INTERVAL_STAT_REMOVE_EMPTY,
+        INTERVAL_STAT_REMOVE_BOTH,
+        INTERVAL_STAT_REMOVE_RIGHT,
+        INTERVAL_STAT_REMOVE_LEFT,
+        INTERVAL_STAT_REMOVE_NEITHER,
+        INTERVAL_STAT_REMOVE_CASE1,
+        INTERVAL_STAT_REMOVE_CASE2,
+        INTERVAL_STAT_REMOVE_CASE3,
+        INTERVAL_STAT_REMOVE_CASE4,
+        INTERVAL_STAT_CASES
+};
+
+#define INTERVAL_STAT_CYCLE_BUCKETS 64
+
+/*
+        Unit of the add and remove latency histograms: time stamp counter
+        ticks where the CPU has one, nanoseconds elsewhere.
+ */
+
+#ifdef INTERVAL_HAVE_RDTSC
+#define INTERVAL_STAT_CLOCK_UNIT "cycles"
+#else
+#define INTERVAL_STAT_CLOCK_UNIT "ns"
+#endif
+
+typedef struct
+{
+        unsigned long   cases[INTERVAL_STAT_CASES];
+        unsigned long   adds;
+        unsigned long   removes;
+        unsigned long   traversed;
+        unsigned long   rotations;
+        unsigned long   allocated;
+        unsigned long   freed;
+        unsigned long   cycles[2][INTERVAL_STAT_CYCLE_BUCKETS];
+} interval_stats_t;
+
+#ifdef INTERVAL_STATS
+#define INTERVAL_STAT_HIT( is, c ) ( ( is )->stats.cases[c]++ )
+#define INTERVAL_STAT_COUNT( is, field ) ( ( is )->stats.field++ )
+#else
+#define INTERVAL_STAT_HIT( is, c ) ( ( void ) 0 )
+#define INTERVAL_STAT_COUNT( is, field ) ( ( void ) 0 )
+#endif
+
+/*
+        One change made to a set by an operation: an interval inserted, 
+        deleted, or resized from [oldLeft, oldRight) to [left, right). For
+        deletes, [left, right) is the interval that was deleted.
+ */
+
+typedef struct
+{
+        int             kind;
+        int             left;
+        int             right;
+        int             oldLeft;
+        int             oldRight;
+} interval_change_t;
+
+typedef void ( *interval_feed_t )( const interval_change_t* change, void* context );
+
+/*
+        A single add or remove of [left, right), as applied in bulk by
+        interval_set_apply_batch. This is also the record layout of the 
+        driver's binary input format ( three native-endian 32 bit ints ).
+ */
+
+typedef struct
+{
+        int             kind;
+        int             left;
+        int             right;
+} interval_op_t;
+
+/*
+        With the list backend, besides the sorted doubly linked list 
+        ( head to tail ), every node is also kept in a treap keyed on 'left' 
+        ( rooted at 'root' ). The list is what we walk when printing or 
+        splicing out a run of nodes, while the treap lets us find the nodes 
+        an operation lands on in O(log n) instead of scanning the list from 
+        the head. Every treap node also keeps the number of nodes ( 'size' )
+        and the total length of the intervals ( 'length' ) in its subtree,
+        for counting and covered-length queries. 'finger' is the node the
+        last operation touched, where the next one starts its searches.
+        'modifications' counts the changes to the set, whatever its backend,
+        so that a cursor can tell when the nodes or indices it holds may be
+        gone.
+ */
+
 typedef struct
 {
+        int             backend;
+
         interval_t*     head;
         interval_t*     tail;
+        interval_t*     root;
+        interval_t*     finger;
+        unsigned int    seed;
+        unsigned long   modifications;
+
+        interval_slab_t*        slabs;
+        interval_slab_t*        cursor;
+        interval_t*             free_nodes;
+
+        interval_array_t        array;
+        interval_blocks_t       blocks;
+        interval_chunks_t       chunks;
+
+        /*
+                Deferred mode: with a 'pendingCapacity', adds and removes are
+                queued in 'pending' ( coalescing with the ones before them )
+                and only applied when the set is read or the queue is full.
+         */
+
+        interval_op_t*          pending;
+        size_t                  pendingCount;
+        size_t                  pendingCapacity;
+
+        /*
+                Change feed: every change is passed to 'feed' if it is set,
+                and recorded in 'feedBuffer' if that is set ( changes past 
+                'feedCapacity' are only counted, so a consumer can tell that
+                it missed some ).
+         */
+
+        interval_feed_t         feed;
+        void*                   feedContext;
+        interval_change_t*      feedBuffer;
+        size_t                  feedCapacity;
+        size_t                  feedCount;
+
+#ifdef INTERVAL_STATS
+        interval_stats_t        stats;
+#endif
 } interval_set_t;
 
-void
-interval_print( interval_t* i )
+/*
+        A node of the immutable treap behind the concurrent set. Once a 
+        node has been published it is never modified: a writer copies every
+        node on the paths it changes ( sharing the untouched subtrees ) and
+        then publishes the new root, so a reader holding an old root keeps
+        seeing a consistent snapshot. The versioned set shares the node 
+        type, but counts the references to each node in 'refs' instead.
+ */
+
+typedef struct INTERVAL_PNODE
 {
-        printf( "[%d, %d)\n", i->left, i->right );
-}
+        int                     left;
+        int                     right;
+        unsigned int            priority;
+        _Atomic unsigned int    refs;
+        unsigned long           version;
+        struct INTERVAL_PNODE*  lchild;
+        struct INTERVAL_PNODE*  rchild;
+} interval_pnode_t;
 
-void
-interval_set_print( interval_set_t* is )
+typedef struct
 {
-        interval_t*     p = is->head;
+        interval_pnode_t*       node;
+        unsigned long           epoch;
+} interval_retired_t;
 
-        printf( "{" );
+/*
+        Each reader announces the epoch it entered in ( 0 while it is not
+        reading ), one slot per cache line so that readers do not contend.
+ */
 
-        while ( p )
-        {
-                printf( "[%d, %d)", p->left, p->right );
+typedef struct
+{
+        _Atomic unsigned long   epoch;
+        _Atomic int             used;
+        char                    pad[INTERVAL_CACHE_LINE - sizeof( unsigned long ) - sizeof( int )];
+} interval_reader_t;
 
-                if ( p->next )
-                {
-                        printf( ", " );
-                }
+/*
+        Concurrent set: any number of lock-free readers and writers that 
+        are serialized by a mutex. Nodes replaced by a write are retired 
+        with the epoch they were unpublished in and only freed once every
+        reader has entered a later epoch ( epoch-based reclamation ).
+ */
 
-                p = p->next;
-        }
-        printf( "}\n" );
-}
+typedef struct
+{
+        _Atomic( interval_pnode_t* )    root;
+        _Atomic unsigned long           epoch;
+        interval_reader_t               readers[INTERVAL_MAX_READERS];
+
+        pthread_mutex_t                 writer;
+        unsigned int                    seed;
+        unsigned long                   version;
+        interval_retired_t*             retired;
+        size_t                          retiredHead;
+        size_t                          retiredCount;
+        size_t                          retiredCapacity;
+} interval_set_concurrent_t;
+
+typedef struct
+{
+        const interval_pnode_t*         root;
+} interval_snapshot_t;
+
+/*
+        Versioned set: every add or remove produces a new version, a treap
+        that shares all but the copied search paths with the one before it.
+        'versions' holds one reference to the root of each version that has
+        not been released yet, and a node is freed when the last reference
+        to it goes. Slot i holds version base + i; the slots before 'first'
+        were released, and are given back by sliding the rest down when
+        the array fills, so the array only grows with the span between the
+        oldest unreleased version and the current one.
+ */
+
+typedef struct
+{
+        interval_pnode_t*       root;
+        int                     live;
+} interval_version_t;
+
+typedef struct
+{
+        interval_version_t*     versions;
+        unsigned long           base;
+        unsigned long           first;
+        unsigned long           count;
+        unsigned long           capacity;
+        unsigned int            seed;
+} interval_set_versioned_t;
+
+/*
+        Interval map: disjoint intervals, each carrying a payload of the 
+        map's 'payloadSize' bytes ( stored inline after the node ), kept in
+        a treap keyed on 'left'. Unlike a set, touching intervals stay apart
+        unless their payloads are equal.
+ */
+
+typedef struct INTERVAL_MNODE
+{
+        int                     left;
+        int                     right;
+        unsigned int            priority;
+        struct INTERVAL_MNODE*  lchild;
+        struct INTERVAL_MNODE*  rchild;
+        unsigned char           payload[];
+} interval_mnode_t;
+
+typedef struct
+{
+        interval_mnode_t*       root;
+        size_t                  payloadSize;
+        size_t                  count;
+        unsigned int            seed;
+} interval_map_t;
+
+/*
+        Sharded set: the key space is cut into ranges, shard i holding the
+        part of the set within [lo of shard i, lo of shard i + 1), each in 
+        its own set with its own lock. Operations lock only the shards they
+        touch ( in ascending order, so that ones spanning several shards 
+        still apply atomically ), while 'layout' is held exclusively only 
+        to move the boundaries when rebalancing.
+ */
+
+typedef struct
+{
+        interval_set_t*         set;
+        pthread_mutex_t         lock;
+        int                     lo;
+        _Atomic unsigned long   ops;
+} interval_shard_t;
+
+typedef struct
+{
+        int                     backend;
+        int                     count;
+        interval_shard_t*       shards;
+        pthread_rwlock_t        layout;
+} interval_set_sharded_t;
+
+/*
+        Snapshot file layout: this header, then 'count' left values and 
+        'count' right values ( native-endian 32 bit ints, sorted, disjoint
+        and not touching ), so that a mapped file can be searched in place
+        just like the array backend.
+ */
+
+typedef struct
+{
+        char            magic[8];
+        uint32_t        version;
+        uint32_t        headerSize;
+        uint64_t        count;
+        uint64_t        reserved;
+} interval_image_header_t;
+
+/*
+        A snapshot file mapped read-only.
+ */
+
+typedef struct
+{
+        void*           map;
+        size_t          size;
+        const int*      lefts;
+        const int*      rights;
+        size_t          count;
+} interval_image_t;
+
+/*
+        An append-only log of operations ( interval_op_t records, the same
+        as the driver's binary input ), buffered until the next sync.
+ */
+
+typedef struct
+{
+        int             fd;
+        size_t          count;
+        interval_op_t   buffer[INTERVAL_LOG_BUFFER];
+} interval_log_t;
+
+/*
+        Shared-memory set: a treap whose nodes live in a shared memory 
+        segment, right after this header, and refer to each other by their
+        index in the segment ( 0 for none, so node 0 is never used ). One 
+        writer process changes it in place, and any number of processes map
+        it read-only and search it directly. 'sequence' is a seqlock: odd 
+        while a write is in progress, and a reader retries if it changed 
+        while the reader was looking. Unused nodes are chained through their 
+        'lchild' from 'free', and nodes past 'used' were never used.
+ */
+
+typedef struct
+{
+        char                    magic[8];
+        uint32_t                version;
+        uint32_t                headerSize;
+        _Atomic uint32_t        sequence;
+        uint32_t                capacity;
+        uint32_t                root;
+        uint32_t                count;
+        uint32_t                free;
+        uint32_t                used;
+        uint32_t                seed;
+        char                    pad[INTERVAL_CACHE_LINE - 44];
+} interval_shared_header_t;
+
+typedef struct
+{
+        int                     left;
+        int                     right;
+        uint32_t                priority;
+        uint32_t                lchild;
+        uint32_t                rchild;
+} interval_shared_node_t;
+
+/*
+        A process's mapping of a shared-memory set.
+ */
+
+typedef struct
+{
+        void*                           map;
+        size_t                          size;
+        interval_shared_header_t*       header;
+        interval_shared_node_t*         nodes;
+        int                             writable;
+} interval_shared_t;
+
+/*
+        Walks the intervals of a set in order, whatever its backend.
+ */
+
+typedef struct
+{
+        interval_set_t*                 is;
+        interval_t*                     node;
+        size_t                          index;
+        interval_block_cursor_t         cursor;
+        size_t                          offset;
+        int                             pending;
+        int                             pendingLeft;
+        int                             pendingRight;
+} interval_iter_t;
+
+/*
+        A position in a set for walking it both ways: the interval it is on
+        and, for the list and array backends, where that interval is stored
+        ( the others search again from the interval's bounds ). The set's
+        'modifications' when the cursor last moved tells whether 'node' and
+        'index' can still be trusted. If the set has changed since, the 
+        cursor searches again from its interval's bounds.
+ */
+
+typedef struct
+{
+        interval_set_t*                 is;
+        interval_t*                     node;
+        size_t                          index;
+        unsigned long                   modifications;
+        int                             left;
+        int                             right;
+        int                             valid;
+} interval_cursor_t;
 
 void
-interval_set_free( interval_set_t* is )
+interval_print( interval_t* i )
+{
+        printf( "[%d, %d)\n", i->left, i->right );
+}
+
+static uint32_t
+interval_varint_get( const unsigned char** p )
 {
-        interval_t*     prev;
-        interval_t*     p = is->head;
+        uint32_t        value = 0;
+        int             shift = 0;
 
-        while (p)
+        while ( **p & 0x80 )
         {
-                prev = p;
-                p = p->next;
-                free(prev);
+                value |= ( uint32_t ) ( *( *p )++ & 0x7F ) << shift;
+                shift += 7;
         }
 
-        free(is);
+        return value | ( uint32_t ) *( *p )++ << shift;
 }
 
-void
-interval_set_add( interval_set_t* is,
-                int newLeft,
-                int newRight,
-                int should_print )
+static unsigned char*
+interval_varint_put( unsigned char* p, uint32_t value )
 {
-        if ( newLeft >= newRight )
+        while ( value >= 0x80 )
         {
-                return;
+                *p++ = ( unsigned char ) ( value | 0x80 );
+                value >>= 7;
         }
 
-        if ( !is->head )
-        {
-                is->head = ( interval_t* ) calloc( 1, sizeof( interval_t ) );
+        *p++ = ( unsigned char ) value;
 
-                is->head->left = newLeft;
-                is->head->right = newRight;
-                is->tail = is->head;
-        }
+        return p;
+}
 
-        if ( newRight < is->head->left )
-        {
-                /*
-                        Both 'newLeft' and 'newRight' represent a range LESS
-                        than any existing interval.
-                 */
+static void
+interval_block_open( interval_block_cursor_t* c, const interval_block_t* block )
+{
+        c->block = block;
+        c->p = block->data;
+        c->index = 0;
+        c->right = 0;
+}
+
+static int
+interval_block_read( interval_block_cursor_t* c, int* left, int* right )
+{
+        /*
+                Gaps and lengths are added as unsigned 32 bit values, since
+                they can be wider than INT_MAX.
+         */
 
-                interval_t*             temp = ( interval_t* ) calloc( 1, sizeof( interval_t ) );
-                temp->left = newLeft;
-                temp->right = newRight;
+        if ( c->index == c->block->count )
+        {
+                return 0;
+        }
 
-                temp->next = is->head;
-                is->head->prev = temp;
-                is->head = temp;
+        if ( c->index == 0 )
+        {
+                *left = c->block->first;
         }
-        else if ( newLeft > is->tail->right )
+        else
         {
-                /*
-                        Both 'newLeft' and 'newRight' represent a range GREATER
-                        than any existing interval.
-                 */
+                *left = ( int ) ( ( uint32_t ) c->right + interval_varint_get( &c->p ) );
+        }
 
-                interval_t*             temp = ( interval_t* ) calloc( 1, sizeof( interval_t ) );
-                temp->left = newLeft;
-                temp->right = newRight;
+        *right = ( int ) ( ( uint32_t ) *left + interval_varint_get( &c->p ) );
 
-                is->tail->next = temp;
-                temp->prev = is->tail;
-                is->tail = temp;
-        }
+        c->right = *right;
+        c->index++;
 
-        /*
-                In the following while loop, we look for the interval nodes
-                that 'newLeft' and 'newRight' are within the range of ( pointed 
-                to by lNode and rNode respectively ). 
+        return 1;
+}
 
-                The value of the pointers is then used to determine how the 
-                range [newLeft, newRight) can be added to the interval set.
+static int
+interval_chunk_next( const interval_chunk_t* c, size_t* offset, int* lo, int* hi )
+{
+        /*
+                Reads the next run of a chunk, in chunk coordinates. 'offset'
+                is an index into the runs, or the bit to continue from in a 
+                bitmap.
          */
 
-        interval_t*     p = is->head;
-        interval_t*     lNode = NULL;
-        interval_t*     rNode = NULL;
+        size_t          w;
+        uint64_t        bits;
 
-        while ( p )
+        if ( !c->bitmap )
         {
-                if ( p->left <= newLeft && newLeft <= p->right )
+                if ( *offset == c->array.count )
                 {
-                        lNode = p;
+                        return 0;
                 }
 
-                if ( p->left <= newRight && newRight <= p->right )
-                {
-                        rNode = p;
-                }
+                *lo = c->array.lefts[*offset];
+                *hi = c->array.rights[*offset];
+                ( *offset )++;
 
-                p = p->next;
+                return 1;
         }
 
-        if ( ( lNode && rNode ) && ( lNode != rNode ) )
+        if ( *offset >= INTERVAL_CHUNK_SIZE )
         {
-                /*
-                        If lNode and rNode are both not null AND not 
-                        identical, then 'newLeft' and 'newRight' are within 
-                        intervals that are already in the set and we
-                        can simply update the nodes and delete everything
-                        inbetween.
-
-                        For example:
-                                Given :{ [1, 2), [5, 7), [10, 14) } 
-                                then Add: [2, 11)
-                                The result would be: { [1, 3), [10, 14) }
-
-                        It is important for them to not be same, because
-                        if they were identical, then that means the range
-                        [newLeft, newRight) already exists in a range in the set.
-
-                        For example:
-                                Given: { [1, 7), [10, 14) }
-                                then Add: [2, 5)
-                                The result would be: { [1, 7), [10, 14) }
-                                ( Notice that it doesn't change! )
-
-                        This would essentially be a no-op and as such is not
-                        checked by any if or else-if statement.
-                 */
+                return 0;
+        }
 
-                interval_t*             temp = lNode->next;
- 
-                lNode->right = rNode->right;
-                lNode->next = rNode->next;
- 
-                while ( temp != lNode->next )
-                {
-                        temp = temp->next;
-                        free( temp->prev );
-                }
+        w = *offset >> 6;
+        bits = c->bitmap[w] & ( ~0ull << ( *offset & 63 ) );
 
-                if ( !lNode->next )
+        while ( !bits )
+        {
+                if ( ++w == INTERVAL_CHUNK_WORDS )
                 {
-                        is->tail = lNode;
+                        *offset = INTERVAL_CHUNK_SIZE;
+                        return 0;
                 }
-        }
-        else if ( !lNode && rNode )
-        {
-                /*
-                        If lNode is not defined and rNode is defined, then we
-                        know 'newLeft' is less than any interval in the set and 
-                        'newRight' is within an interval in the set.
 
-                        Therefore, we can update the node 'newRight' would belong in 
-                        and delete all nodes before it.
-                 */
+                bits = c->bitmap[w];
+        }
 
-                interval_t*             temp = is->head;
+        *lo = ( int ) ( w * 64 ) + __builtin_ctzll( bits );
+        *hi = INTERVAL_CHUNK_SIZE;
 
-                rNode->left = newLeft;
+        bits = ~c->bitmap[w] & ( ~0ull << ( *lo & 63 ) );
 
-                while ( temp != rNode )
+        while ( !bits )
+        {
+                if ( ++w == INTERVAL_CHUNK_WORDS )
                 {
-                        temp = temp->next;
-                        free( temp->prev );
+                        break;
                 }
- 
-                is->head = rNode;
+
+                bits = ~c->bitmap[w];
         }
-        else if ( lNode && !rNode )
+
+        if ( bits )
+        {
+                *hi = ( int ) ( w * 64 ) + __builtin_ctzll( bits );
+        }
+
+        *offset = *hi;
+
+        return 1;
+}
+
+static int
+interval_chunk_value( int key, int local )
+{
+        return ( int ) ( ( ( int64_t ) key << INTERVAL_CHUNK_BITS ) + local - 2147483648LL );
+}
+
+static int
+interval_chunk_last( const interval_chunk_t* c )
+{
+        return c->span ? c->key + c->span - 1 : c->key;
+}
+
+static int
+interval_chunk_end( const interval_chunk_t* c )
+{
+        /*
+                The value just past a span. A span never reaches the last 
+                chunk, as INT32_MAX is never in a set.
+         */
+
+        return ( int ) ( ( ( int64_t ) interval_chunk_last( c ) + 1 ) * INTERVAL_CHUNK_SIZE - 2147483648LL );
+}
+
+static int
+interval_chunks_read( const interval_chunks_t* cs, size_t* index, size_t* offset, int* left, int* right )
+{
+        /*
+                Reads the next run of the chunks from ( index, offset ) on, 
+                without merging runs that continue into the next chunk. A 
+                span is a single run, with an 'offset' of 1 once read.
+         */
+
+        int     lo;
+        int     hi;
+
+        while ( *index < cs->count )
+        {
+                if ( cs->chunks[*index].span )
+                {
+                        if ( !*offset )
+                        {
+                                *left = interval_chunk_value( cs->chunks[*index].key, 0 );
+                                *right = interval_chunk_end( &cs->chunks[*index] );
+                                *offset = 1;
+
+                                return 1;
+                        }
+                }
+                else if ( interval_chunk_next( &cs->chunks[*index], offset, &lo, &hi ) )
+                {
+                        *left = interval_chunk_value( cs->chunks[*index].key, lo );
+                        *right = interval_chunk_value( cs->chunks[*index].key, hi );
+
+                        return 1;
+                }
+
+                ( *index )++;
+                *offset = 0;
+        }
+
+        return 0;
+}
+
+/*
+        Applies the operations queued in deferred mode. Everything that 
+        reads a set calls this first ( iterating does, so printing, saving
+        and combining sets do too ), so that queued operations are never 
+        observable.
+ */
+
+void interval_set_flush( interval_set_t* is );
+
+static void
+interval_iter_begin( interval_iter_t* it, interval_set_t* is )
+{
+        interval_set_flush( is );
+
+        it->is = is;
+        it->node = is->head;
+        it->index = 0;
+        it->cursor.block = NULL;
+        it->offset = 0;
+        it->pending = 0;
+}
+
+static int
+interval_iter_next( interval_iter_t* it, int* left, int* right )
+{
+        if ( it->is->backend == INTERVAL_BACKEND_HYBRID )
         {
                 /*
-                        If lNode is defined and rNode is not defined, then
-                        'newLeft' is within an interval in the set AND 'newRight' is 
-                        greater than any interval in the set.
+                        An interval can span several chunks, so runs are 
+                        merged until one doesn't start where the last ended,
+                        and that one is kept for the next call.
+                 */
+
+                int     l;
+                int     r;
+
+                if ( !it->pending && !interval_chunks_read( &it->is->chunks, &it->index, &it->offset, &it->pendingLeft, &it->pendingRight ) )
+                {
+                        return 0;
+                }
+
+                *left = it->pendingLeft;
+                *right = it->pendingRight;
+                it->pending = 0;
+
+                while ( interval_chunks_read( &it->is->chunks, &it->index, &it->offset, &l, &r ) )
+                {
+                        if ( l != *right )
+                        {
+                                it->pendingLeft = l;
+                                it->pendingRight = r;
+                                it->pending = 1;
+                                break;
+                        }
+
+                        *right = r;
+                }
+
+                return 1;
+        }
+
+        if ( it->is->backend == INTERVAL_BACKEND_BLOCK )
+        {
+                while ( !it->cursor.block || !interval_block_read( &it->cursor, left, right ) )
+                {
+                        if ( it->index == it->is->blocks.count )
+                        {
+                                return 0;
+                        }
+
+                        interval_block_open( &it->cursor, &it->is->blocks.blocks[it->index++] );
+                }
+
+                return 1;
+        }
+
+        if ( it->is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                if ( it->index == it->is->array.count )
+                {
+                        return 0;
+                }
+
+                *left = it->is->array.lefts[it->index];
+                *right = it->is->array.rights[it->index];
+                it->index++;
+
+                return 1;
+        }
+
+        if ( !it->node )
+        {
+                return 0;
+        }
+
+        *left = it->node->left;
+        *right = it->node->right;
+        it->node = it->node->next;
+
+        return 1;
+}
+
+/*
+        A growable text buffer, so that a whole set is formatted in memory
+        and written out with a single fwrite.
+ */
+
+typedef struct
+{
+        char*           data;
+        size_t          length;
+        size_t          capacity;
+} interval_text_t;
+
+static void
+interval_text_append( interval_text_t* text, const char* s, size_t n )
+{
+        if ( text->length + n > text->capacity )
+        {
+                size_t  capacity = text->capacity ? text->capacity * 2 : 256;
+
+                while ( capacity < text->length + n )
+                {
+                        capacity *= 2;
+                }
+
+                text->data = ( char* ) realloc( text->data, capacity );
+                text->capacity = capacity;
+        }
+
+        memcpy( text->data + text->length, s, n );
+        text->length += n;
+}
+
+static void
+interval_text_int( interval_text_t* text, int value )
+{
+        char            digits[12];
+        char*           p = digits + sizeof( digits );
+        unsigned int    magnitude = value < 0 ? 0u - ( unsigned int ) value : ( unsigned int ) value;
+
+        do
+        {
+                *--p = ( char ) ( '0' + magnitude % 10 );
+                magnitude /= 10;
+        }
+        while ( magnitude );
+
+        if ( value < 0 )
+        {
+                *--p = '-';
+        }
+
+        interval_text_append( text, p, digits + sizeof( digits ) - p );
+}
+
+static void
+interval_text_interval( interval_text_t* text, int left, int right )
+{
+        /*
+                Appends "[left, right)", preceded by ", " unless it is the 
+                first interval after the opening brace.
+         */
+
+        if ( text->length && text->data[text->length - 1] != '{' )
+        {
+                interval_text_append( text, ", ", 2 );
+        }
+
+        interval_text_append( text, "[", 1 );
+        interval_text_int( text, left );
+        interval_text_append( text, ", ", 2 );
+        interval_text_int( text, right );
+        interval_text_append( text, ")", 1 );
+}
+
+static void
+interval_text_flush( interval_text_t* text, FILE* out )
+{
+        fwrite( text->data, 1, text->length, out );
+        free( text->data );
+
+        text->data = NULL;
+        text->length = 0;
+        text->capacity = 0;
+}
+
+void
+interval_set_print( interval_set_t* is )
+{
+        interval_text_t         text = { 0 };
+        interval_iter_t         it;
+        int                     left;
+        int                     right;
+
+        interval_text_append( &text, "{", 1 );
+        interval_iter_begin( &it, is );
+
+        while ( interval_iter_next( &it, &left, &right ) )
+        {
+                interval_text_interval( &text, left, right );
+        }
+
+        interval_text_append( &text, "}\n", 2 );
+        interval_text_flush( &text, stdout );
+}
+
+void
+interval_set_feed_callback( interval_set_t* is, interval_feed_t feed, void* context )
+{
+        /*
+                Reports every later change of the set to 'feed' ( NULL to 
+                stop ).
+         */
+
+        is->feed = feed;
+        is->feedContext = context;
+}
+
+void
+interval_set_feed_buffer( interval_set_t* is, interval_change_t* buffer, size_t capacity )
+{
+        /*
+                Records every later change of the set into 'buffer' ( NULL to
+                stop ), to be collected with interval_set_feed_take.
+         */
+
+        is->feedBuffer = buffer;
+        is->feedCapacity = capacity;
+        is->feedCount = 0;
+}
+
+size_t
+interval_set_feed_take( interval_set_t* is, int* overflow )
+{
+        /*
+                Returns how many changes were recorded into the feed buffer 
+                since the last call and starts over at its beginning. If more
+                changes happened than fit, 'overflow' is set and the consumer
+                has to resynchronize from the full set.
+         */
+
+        size_t  count = is->feedCount;
+
+        *overflow = count > is->feedCapacity;
+        is->feedCount = 0;
+
+        return *overflow ? is->feedCapacity : count;
+}
+
+static void
+interval_set_emit( interval_set_t* is, int kind, int left, int right, int oldLeft, int oldRight )
+{
+        interval_change_t       change;
+
+        if ( !is || ( !is->feed && !is->feedBuffer ) )
+        {
+                return;
+        }
+
+        change.kind = kind;
+        change.left = left;
+        change.right = right;
+        change.oldLeft = oldLeft;
+        change.oldRight = oldRight;
+
+        if ( is->feed )
+        {
+                is->feed( &change, is->feedContext );
+        }
+
+        if ( is->feedBuffer )
+        {
+                if ( is->feedCount < is->feedCapacity )
+                {
+                        is->feedBuffer[is->feedCount] = change;
+                }
+
+                is->feedCount++;
+        }
+}
+
+interval_set_t*
+interval_set_create( int backend )
+{
+        interval_set_t*         is = ( interval_set_t* ) calloc( 1, sizeof( interval_set_t ) );
+
+        is->backend = backend;
+
+        return is;
+}
+
+static interval_t*
+interval_set_alloc_node( interval_set_t* is )
+{
+        interval_t*     node;
+
+        if ( is->free_nodes )
+        {
+                node = is->free_nodes;
+                is->free_nodes = node->next;
+        }
+        else
+        {
+                if ( is->cursor && is->cursor->used == is->cursor->capacity && is->cursor->next )
+                {
+                        is->cursor = is->cursor->next;
+                        is->cursor->used = 0;
+                }
+
+                if ( !is->cursor || is->cursor->used == is->cursor->capacity )
+                {
+                        size_t                  capacity = INTERVAL_SLAB_MIN_NODES;
+                        interval_slab_t*        slab;
+
+                        if ( is->cursor )
+                        {
+                                capacity = is->cursor->capacity * 2;
+
+                                if ( capacity > INTERVAL_SLAB_MAX_NODES )
+                                {
+                                        capacity = INTERVAL_SLAB_MAX_NODES;
+                                }
+                        }
+
+                        slab = ( interval_slab_t* ) malloc( sizeof( interval_slab_t ) + capacity * sizeof( interval_t ) );
+
+                        slab->next = NULL;
+                        slab->capacity = capacity;
+                        slab->used = 0;
+
+                        if ( is->cursor )
+                        {
+                                is->cursor->next = slab;
+                        }
+                        else
+                        {
+                                is->slabs = slab;
+                        }
+
+                        is->cursor = slab;
+                }
+
+                node = &is->cursor->nodes[ is->cursor->used++ ];
+        }
+
+        memset( node, 0, sizeof( interval_t ) );
+
+        INTERVAL_STAT_COUNT( is, allocated );
+
+        return node;
+}
+
+static void
+interval_set_free_node( interval_set_t* is, interval_t* node )
+{
+        node->next = is->free_nodes;
+        is->free_nodes = node;
+
+        INTERVAL_STAT_COUNT( is, freed );
+}
+
+void
+interval_set_free( interval_set_t* is )
+{
+        /*
+                Every node lives in one of the set's slabs, so releasing the
+                slabs releases all of the nodes without walking the list.
+         */
+
+        interval_slab_t*        prev;
+        interval_slab_t*        p = is->slabs;
+
+        while (p)
+        {
+                prev = p;
+                p = p->next;
+                free(prev);
+        }
+
+        for ( size_t i = 0; i < is->blocks.count; i++ )
+        {
+                free( is->blocks.blocks[i].data );
+        }
+
+        for ( size_t i = 0; i < is->chunks.count; i++ )
+        {
+                free( is->chunks.chunks[i].bitmap );
+                free( is->chunks.chunks[i].array.lefts );
+                free( is->chunks.chunks[i].array.rights );
+        }
+
+        free(is->pending);
+        free(is->chunks.chunks);
+        free(is->blocks.blocks);
+        free(is->array.lefts);
+        free(is->array.rights);
+        free(is);
+}
+
+static const char* interval_stat_names[INTERVAL_STAT_CASES] =
+{
+        "add_head", "add_tail", "add_both", "add_right", "add_left",
+        "add_case1", "add_case2", "add_case3", "add_case4", "add_inside",
+        "remove_empty", "remove_both", "remove_right", "remove_left", "remove_neither",
+        "remove_case1", "remove_case2", "remove_case3", "remove_case4"
+};
+
+int
+interval_set_stats( const interval_set_t* is, interval_stats_t* stats )
+{
+        /*
+                Copies the set's counters into 'stats'. Returns -1 ( and 
+                zeroes 'stats' ) if the counters were not compiled in.
+         */
+
+#ifdef INTERVAL_STATS
+        *stats = is->stats;
+
+        return 0;
+#else
+        ( void ) is;
+
+        memset( stats, 0, sizeof( interval_stats_t ) );
+
+        return -1;
+#endif
+}
+
+void
+interval_set_stats_reset( interval_set_t* is )
+{
+#ifdef INTERVAL_STATS
+        memset( &is->stats, 0, sizeof( interval_stats_t ) );
+#else
+        ( void ) is;
+#endif
+}
+
+int
+interval_set_stats_print( const interval_set_t* is, FILE* out )
+{
+        /*
+                Dumps the counters as one "name value" pair per line ( 
+                histogram buckets as "add_cycles_2^N count", or "add_ns_2^N"
+                where the clock is in nanoseconds, empty buckets skipped ), 
+                for grepping or loading into a spreadsheet. The unit is also
+                printed on its own as "clock_unit".
+         */
+
+        interval_stats_t        stats;
+
+        if ( interval_set_stats( is, &stats ) < 0 )
+        {
+                return -1;
+        }
+
+        fprintf( out, "adds %lu\nremoves %lu\n", stats.adds, stats.removes );
+
+        for ( int i = 0; i < INTERVAL_STAT_CASES; i++ )
+        {
+                fprintf( out, "%s %lu\n", interval_stat_names[i], stats.cases[i] );
+        }
+
+        fprintf( out, "traversed %lu\nrotations %lu\nallocated %lu\nfreed %lu\n",
+                        stats.traversed, stats.rotations, stats.allocated, stats.freed );
+
+        fprintf( out, "clock_unit %s\n", INTERVAL_STAT_CLOCK_UNIT );
+
+        for ( int kind = 0; kind < 2; kind++ )
+        {
+                for ( int i = 0; i < INTERVAL_STAT_CYCLE_BUCKETS; i++ )
+                {
+                        if ( stats.cycles[kind][i] )
+                        {
+                                fprintf( out, "%s_%s_2^%d %lu\n", kind ? "remove" : "add", INTERVAL_STAT_CLOCK_UNIT, i, stats.cycles[kind][i] );
+                        }
+                }
+        }
+
+        return 0;
+}
+
+#ifdef INTERVAL_STATS
+static uint64_t
+interval_stats_clock( void )
+{
+#ifdef INTERVAL_HAVE_RDTSC
+        return __rdtsc();
+#else
+        struct timespec         ts;
+
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+
+        return ( uint64_t ) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static void
+interval_stats_record( interval_set_t* is, int kind, uint64_t start )
+{
+        uint64_t        elapsed = interval_stats_clock() - start;
+
+        is->stats.cycles[kind][63 - __builtin_clzll( elapsed | 1 )]++;
+}
+#endif
+
+static unsigned int
+interval_set_random( interval_set_t* is )
+{
+        /*
+                xorshift32, seeded lazily so that a zeroed ( calloc'd ) set
+                is still a valid empty set.
+         */
+
+        if ( !is->seed )
+        {
+                is->seed = 2463534242u;
+        }
+
+        is->seed ^= is->seed << 13;
+        is->seed ^= is->seed >> 17;
+        is->seed ^= is->seed << 5;
+
+        return is->seed;
+}
+
+static void
+interval_set_pull( interval_t* node )
+{
+        /*
+                Recomputes the subtree totals of a node from its children.
+         */
+
+        node->size = 1;
+        node->length = ( int64_t ) node->right - node->left;
+
+        if ( node->lchild )
+        {
+                node->size += node->lchild->size;
+                node->length += node->lchild->length;
+        }
+
+        if ( node->rchild )
+        {
+                node->size += node->rchild->size;
+                node->length += node->rchild->length;
+        }
+}
+
+static void
+interval_set_adjust_path( interval_t* node, int size, int64_t length )
+{
+        /*
+                Adds to the subtree totals of a node and all its ancestors.
+         */
+
+        for ( ; node; node = node->parent )
+        {
+                node->size += size;
+                node->length += length;
+        }
+}
+
+static void
+interval_set_rotate_up( interval_set_t* is, interval_t* node )
+{
+        interval_t*     parent = node->parent;
+        interval_t*     grandparent = parent->parent;
+
+        INTERVAL_STAT_COUNT( is, rotations );
+
+        if ( parent->lchild == node )
+        {
+                parent->lchild = node->rchild;
+
+                if ( node->rchild )
+                {
+                        node->rchild->parent = parent;
+                }
+
+                node->rchild = parent;
+        }
+        else
+        {
+                parent->rchild = node->lchild;
+
+                if ( node->lchild )
+                {
+                        node->lchild->parent = parent;
+                }
+
+                node->lchild = parent;
+        }
+
+        parent->parent = node;
+        node->parent = grandparent;
+
+        if ( !grandparent )
+        {
+                is->root = node;
+        }
+        else if ( grandparent->lchild == parent )
+        {
+                grandparent->lchild = node;
+        }
+        else
+        {
+                grandparent->rchild = node;
+        }
+
+        interval_set_pull( parent );
+        interval_set_pull( node );
+}
+
+interval_t*
+interval_set_floor( interval_set_t* is, int value )
+{
+        /*
+                Returns the node with the greatest 'left' that is less than
+                or equal to 'value', or NULL if every node starts after it.
+
+                Since the intervals in the set are disjoint, this is the only
+                node that could possibly contain 'value'.
+         */
+
+        interval_t*     p = is->root;
+        interval_t*     floor = NULL;
+
+        while ( p )
+        {
+                INTERVAL_STAT_COUNT( is, traversed );
+
+                if ( p->left <= value )
+                {
+                        floor = p;
+                        p = p->rchild;
+                }
+                else
+                {
+                        p = p->lchild;
+                }
+        }
+
+        return floor;
+}
+
+static interval_t*
+interval_set_floor_near( interval_set_t* is, interval_t* finger, int value )
+{
+        /*
+                interval_set_floor, starting from 'finger' ( a node of the 
+                set ) instead of the root. The finger and its neighbours in
+                the list are tried first. Failing that we climb from the 
+                finger while the parent is on the same side of 'value' as
+                the finger, since the first parent on the other side bounds
+                the subtree we came from, and descend from there. For a node
+                d places away from the finger that is O(log d) expected.
+         */
+
+        interval_t*     p = finger;
+        interval_t*     floor = NULL;
+
+        if ( !finger )
+        {
+                return interval_set_floor( is, value );
+        }
+
+        if ( finger->left <= value )
+        {
+                if ( !finger->next || finger->next->left > value )
+                {
+                        return finger;
+                }
+
+                if ( !finger->next->next || finger->next->next->left > value )
+                {
+                        return finger->next;
+                }
+
+                while ( p->parent && p->parent->left <= value )
+                {
+                        INTERVAL_STAT_COUNT( is, traversed );
+
+                        p = p->parent;
+                }
+        }
+        else
+        {
+                if ( !finger->prev || finger->prev->left <= value )
+                {
+                        return finger->prev;
+                }
+
+                while ( p->parent && p->parent->left > value )
+                {
+                        INTERVAL_STAT_COUNT( is, traversed );
+
+                        p = p->parent;
+                }
+
+                /*
+                        We are the right subtree of a parent at or before 
+                        'value', which is the floor unless one of ours is.
+                 */
+
+                floor = p->parent;
+        }
+
+        while ( p )
+        {
+                INTERVAL_STAT_COUNT( is, traversed );
+
+                if ( p->left <= value )
+                {
+                        floor = p;
+                        p = p->rchild;
+                }
+                else
+                {
+                        p = p->lchild;
+                }
+        }
+
+        return floor;
+}
+
+static interval_t*
+interval_set_insert_node( interval_set_t* is, int left, int right )
+{
+        interval_t*     newNode = interval_set_alloc_node( is );
+        interval_t*     parent = NULL;
+        interval_t*     prev = NULL;
+        interval_t*     p = is->root;
+
+        newNode->left = left;
+        newNode->right = right;
+        newNode->priority = interval_set_random( is );
+        newNode->size = 1;
+        newNode->length = ( int64_t ) right - left;
+
+        /*
+                Descend to the leaf position for 'left'. The last node we 
+                turned right at is the node that precedes the new one in the 
+                list. Every node on the way down gains the new node in its
+                subtree.
+         */
+
+        while ( p )
+        {
+                INTERVAL_STAT_COUNT( is, traversed );
+
+                p->size++;
+                p->length += newNode->length;
+                parent = p;
+
+                if ( p->left < left )
+                {
+                        prev = p;
+                        p = p->rchild;
+                }
+                else
+                {
+                        p = p->lchild;
+                }
+        }
+
+        newNode->parent = parent;
+
+        if ( !parent )
+        {
+                is->root = newNode;
+        }
+        else if ( parent->left < left )
+        {
+                parent->rchild = newNode;
+        }
+        else
+        {
+                parent->lchild = newNode;
+        }
+
+        newNode->prev = prev;
+        newNode->next = prev ? prev->next : is->head;
+
+        if ( newNode->prev )
+        {
+                newNode->prev->next = newNode;
+        }
+        else
+        {
+                is->head = newNode;
+        }
+
+        if ( newNode->next )
+        {
+                newNode->next->prev = newNode;
+        }
+        else
+        {
+                is->tail = newNode;
+        }
+
+        is->finger = newNode;
+
+        while ( newNode->parent && newNode->parent->priority < newNode->priority )
+        {
+                interval_set_rotate_up( is, newNode );
+        }
+
+        interval_set_emit( is, INTERVAL_CHANGE_INSERT, left, right, left, right );
+
+        return newNode;
+}
+
+static void
+interval_set_delete_node( interval_set_t* is, interval_t* node )
+{
+        interval_t*     child;
+
+        interval_set_emit( is, INTERVAL_CHANGE_DELETE, node->left, node->right, node->left, node->right );
+
+        /*
+                Rotate the node down until it has at most one child, then
+                replace it with that child.
+         */
+
+        while ( node->lchild && node->rchild )
+        {
+                if ( node->lchild->priority > node->rchild->priority )
+                {
+                        interval_set_rotate_up( is, node->lchild );
+                }
+                else
+                {
+                        interval_set_rotate_up( is, node->rchild );
+                }
+        }
+
+        child = node->lchild ? node->lchild : node->rchild;
+
+        if ( child )
+        {
+                child->parent = node->parent;
+        }
+
+        if ( !node->parent )
+        {
+                is->root = child;
+        }
+        else if ( node->parent->lchild == node )
+        {
+                node->parent->lchild = child;
+        }
+        else
+        {
+                node->parent->rchild = child;
+        }
+
+        interval_set_adjust_path( node->parent, -1, -( ( int64_t ) node->right - node->left ) );
+
+        if ( is->finger == node )
+        {
+                is->finger = node->prev ? node->prev : node->next;
+        }
+
+        if ( node->prev )
+        {
+                node->prev->next = node->next;
+        }
+        else
+        {
+                is->head = node->next;
+        }
+
+        if ( node->next )
+        {
+                node->next->prev = node->prev;
+        }
+        else
+        {
+                is->tail = node->prev;
+        }
+
+        interval_set_free_node( is, node );
+}
+
+static void
+interval_set_splice( interval_set_t* is, interval_t* first, interval_t* last )
+{
+        /*
+                Deletes the run of consecutive nodes from 'first' to 'last'
+                ( inclusively ). Every node is deleted at most once after it
+                was inserted, so the cost of splicing is amortized over the
+                operations that created the nodes.
+         */
+
+        interval_t*     p = first;
+        interval_t*     next;
+
+        while ( p )
+        {
+                next = ( p == last ) ? NULL : p->next;
+                interval_set_delete_node( is, p );
+                p = next;
+        }
+}
+
+static void
+interval_list_reset( interval_set_t* is )
+{
+        /*
+                Drops every node of the set in O(1), keeping its slabs for 
+                the nodes allocated next.
+         */
+
+        if ( is->slabs )
+        {
+                is->slabs->used = 0;
+        }
+
+        is->cursor = is->slabs;
+        is->free_nodes = NULL;
+        is->head = NULL;
+        is->tail = NULL;
+        is->root = NULL;
+        is->finger = NULL;
+}
+
+static void
+interval_list_clear( interval_set_t* is )
+{
+        /*
+                Deletes every node of the set at once, reporting each one to
+                the change feed ( if there is one ) first.
+         */
+
+        if ( is->feed || is->feedBuffer )
+        {
+                for ( interval_t* p = is->head; p; p = p->next )
+                {
+                        interval_set_emit( is, INTERVAL_CHANGE_DELETE, p->left, p->right, p->left, p->right );
+                }
+        }
+
+        interval_list_reset( is );
+}
+
+static void
+interval_list_build( interval_set_t* is, const int* lefts, const int* rights, size_t count )
+{
+        /*
+                Builds the list and the treap of an empty set from intervals
+                that are already sorted, disjoint and not touching, in O(n).
+
+                The treap is built as a Cartesian tree: a stack holds the
+                right spine of the tree built so far, and each new node 
+                ( which has the greatest key yet ) pops every node of lower
+                priority off the spine and adopts the last one popped as its
+                left child.
+         */
+
+        interval_t**    spine = ( interval_t** ) malloc( ( count ? count : 1 ) * sizeof( interval_t* ) );
+        size_t          depth = 0;
+
+        for ( size_t i = 0; i < count; i++ )
+        {
+                interval_t*     node = interval_set_alloc_node( is );
+                interval_t*     last = NULL;
+
+                node->left = lefts[i];
+                node->right = rights[i];
+                node->priority = interval_set_random( is );
+
+                node->prev = is->tail;
+
+                if ( is->tail )
+                {
+                        is->tail->next = node;
+                }
+                else
+                {
+                        is->head = node;
+                }
+
+                is->tail = node;
+
+                /*
+                        A node popped off the spine gets no more children, 
+                        so its subtree totals are final.
+                 */
+
+                while ( depth && spine[depth - 1]->priority < node->priority )
+                {
+                        last = spine[--depth];
+                        interval_set_pull( last );
+                }
+
+                node->lchild = last;
+
+                if ( last )
+                {
+                        last->parent = node;
+                }
+
+                if ( depth )
+                {
+                        spine[depth - 1]->rchild = node;
+                        node->parent = spine[depth - 1];
+                }
+
+                spine[depth++] = node;
+        }
+
+        is->root = depth ? spine[0] : NULL;
+
+        while ( depth )
+        {
+                interval_set_pull( spine[--depth] );
+        }
+
+        free( spine );
+}
+
+static void
+interval_list_resize( interval_set_t* is, interval_t* node, int left, int right )
+{
+        /*
+                Changes the bounds of a node in place. The caller makes sure
+                the node keeps its position in the list ( and the treap ).
+         */
+
+        if ( node->left != left || node->right != right )
+        {
+                interval_set_emit( is, INTERVAL_CHANGE_RESIZE, left, right, node->left, node->right );
+
+                interval_set_adjust_path( node, 0, ( ( int64_t ) right - left ) - ( ( int64_t ) node->right - node->left ) );
+
+                node->left = left;
+                node->right = right;
+        }
+}
+
+static void
+interval_list_add( interval_set_t* is, int newLeft, int newRight )
+{
+        if ( !is->head || newRight < is->head->left )
+        {
+                /*
+                        Both 'newLeft' and 'newRight' represent a range LESS
+                        than any existing interval ( or the set is empty ).
+                 */
+
+                INTERVAL_STAT_HIT( is, INTERVAL_STAT_ADD_HEAD );
+
+                interval_set_insert_node( is, newLeft, newRight );
+        }
+        else if ( newLeft > is->tail->right )
+        {
+                /*
+                        Both 'newLeft' and 'newRight' represent a range GREATER
+                        than any existing interval.
+                 */
+
+                INTERVAL_STAT_HIT( is, INTERVAL_STAT_ADD_TAIL );
+
+                interval_set_insert_node( is, newLeft, newRight );
+        }
+        else
+        {
+                /*
+                        Look up the interval nodes that 'newLeft' and 'newRight'
+                        are within the range of ( pointed to by lNode and rNode 
+                        respectively ). The nearest node starting at or before
+                        each value is kept in leftFloor and rightFloor, since
+                        those bound the run of nodes the new range covers.
+
+                        The value of the pointers is then used to determine how
+                        the range [newLeft, newRight) can be added to the 
+                        interval set.
+                 */
+
+                interval_t*     leftFloor = interval_set_floor_near( is, is->finger, newLeft );
+                interval_t*     rightFloor = interval_set_floor_near( is, leftFloor, newRight );
+                interval_t*     lNode = NULL;
+                interval_t*     rNode = NULL;
+
+                if ( leftFloor && newLeft <= leftFloor->right )
+                {
+                        lNode = leftFloor;
+                }
+
+                if ( rightFloor && newRight <= rightFloor->right )
+                {
+                        rNode = rightFloor;
+                }
+
+                if ( leftFloor )
+                {
+                        is->finger = leftFloor;
+                }
+
+                if ( ( lNode && rNode ) && ( lNode != rNode ) )
+                {
+                        /*
+                                If lNode and rNode are both not null AND not 
+                                identical, then 'newLeft' and 'newRight' are within 
+                                intervals that are already in the set and we
+                                can simply update the nodes and delete everything
+                                inbetween.
+
+                                For example:
+                                        Given :{ [1, 2), [5, 7), [10, 14) } 
+                                        then Add: [2, 11)
+                                        The result would be: { [1, 14) }
+
+                                It is important for them to not be same, because
+                                if they were identical, then that means the range
+                                [newLeft, newRight) already exists in a range in the set.
+
+                                For example:
+                                        Given: { [1, 7), [10, 14) }
+                                        then Add: [2, 5)
+                                        The result would be: { [1, 7), [10, 14) }
+                                        ( Notice that it doesn't change! )
+
+                                This would essentially be a no-op and as such is only
+                                counted by the final else statement.
+                         */
+
+                        INTERVAL_STAT_HIT( is, INTERVAL_STAT_ADD_BOTH );
+
+                        interval_list_resize( is, lNode, lNode->left, rNode->right );
+
+                        interval_set_splice( is, lNode->next, rNode );
+                }
+                else if ( !lNode && rNode )
+                {
+                        /*
+                                If lNode is not defined and rNode is defined, then we
+                                know 'newLeft' is outside of any interval in the set and 
+                                'newRight' is within an interval in the set.
+
+                                Therefore, we can update the node 'newRight' would belong in 
+                                and delete all nodes between 'newLeft' and it.
+                         */
+
+                        interval_t*     first = leftFloor ? leftFloor->next : is->head;
+
+                        INTERVAL_STAT_HIT( is, INTERVAL_STAT_ADD_RIGHT );
+
+                        if ( first != rNode )
+                        {
+                                interval_set_splice( is, first, rNode->prev );
+                        }
+
+                        interval_list_resize( is, rNode, newLeft, rNode->right );
+                }
+                else if ( lNode && !rNode )
+                {
+                        /*
+                                If lNode is defined and rNode is not defined, then
+                                'newLeft' is within an interval in the set AND 'newRight' is 
+                                outside of any interval in the set.
+
+                                This is the opposite case of the previous else-if
+                                condition.
+
+                                We can update the node 'newLeft' belongs in and delete all 
+                                nodes between it and 'newRight'.
+                         */
+
+                        INTERVAL_STAT_HIT( is, INTERVAL_STAT_ADD_LEFT );
+
+                        if ( rightFloor != lNode )
+                        {
+                                interval_set_splice( is, lNode->next, rightFloor );
+                        }
+
+                        interval_list_resize( is, lNode, lNode->left, newRight );
+                }
+                else if ( !lNode && !rNode )
+                {
+                        /*
+                                If neither lNode or rNode are defined at this point,
+                                then there are 4 subcases we need to check to add the
+                                interval [newLeft, newRight).
+                         */
+
+                        if ( newLeft < is->head->left && newRight > is->tail->right )
+                        {
+                                /*
+                                        Case 1: both 'newLeft' and 'newRight' represent a range 
+                                        that begins before any range in the set and ends after
+                                        any range in the set.
+
+                                        Since this consumes the entire existing set, we can 
+                                        clear the set in place ( without deleting the nodes 
+                                        one by one ) and insert [newLeft, newRight) on its own.
+                                 */
+
+                                INTERVAL_STAT_HIT( is, INTERVAL_STAT_ADD_CASE1 );
+
+                                interval_list_clear( is );
+
+                                interval_set_insert_node( is, newLeft, newRight );
+                        }
+                        else if ( newLeft > is->head->left && newRight < is->tail->right )
+                        {
+                                /*
+                                        Case 2: both 'newLeft' and 'newRight' represent a range in
+                                        between existing intervals in the set.
+
+                                        This could be either a case where both 'newLeft' and
+                                        'newRight' are between any interval in the set or the case
+                                        where 'newLeft' and 'newRight' is a range that covers multiple
+                                        nodes in the set, in which case those nodes would get deleted
+                                        and a new node inserted in the set.
+                                 */
+
+                                interval_t*     nearestLeftNode = leftFloor->next;
+                                interval_t*     nearestRightNode = rightFloor;
+
+                                INTERVAL_STAT_HIT( is, INTERVAL_STAT_ADD_CASE2 );
+
+                                if ( nearestLeftNode->left > newRight )
+                                {
+                                        interval_set_insert_node( is, newLeft, newRight );
+                                }
+                                else
+                                {
+                                        /*
+                                                Reuse nearestLeftNode for the new range and free 
+                                                all nodes after it up to nearestRightNode 
+                                                ( inclusively ).
+                                         */
+
+                                        if ( nearestLeftNode != nearestRightNode )
+                                        {
+                                                interval_set_splice( is, nearestLeftNode->next, nearestRightNode );
+                                        }
+
+                                        interval_list_resize( is, nearestLeftNode, newLeft, newRight );
+                                }
+                        }
+                        else if ( newLeft < is->head->left && newRight > is->head->left )
+                        {
+                                /*
+                                        Case 3: 'newLeft' and 'newRight' represent a range that starts 
+                                        less than any existing range and ends somewhere between existing 
+                                        intervals in the set.
+                                 */
+
+                                interval_t*     keep = is->head;
+
+                                INTERVAL_STAT_HIT( is, INTERVAL_STAT_ADD_CASE3 );
+
+                                if ( keep != rightFloor )
+                                {
+                                        interval_set_splice( is, keep->next, rightFloor );
+                                }
+
+                                interval_list_resize( is, keep, newLeft, newRight );
+                        }
+                        else if ( newLeft > is->head->left && newRight > is->tail->right )
+                        {
+                                /*
+                                        Case 4: 'newLeft' and 'newRight' represent a range that 
+                                        starts between existing ranges in the set and ends 
+                                        greater than any existing range.
+                                 */
+
+                                interval_t*     keep = leftFloor->next;
+
+                                INTERVAL_STAT_HIT( is, INTERVAL_STAT_ADD_CASE4 );
+
+                                if ( keep != is->tail )
+                                {
+                                        interval_set_splice( is, keep->next, is->tail );
+                                }
+
+                                interval_list_resize( is, keep, newLeft, newRight );
+                        }
+                }
+                else
+                {
+                        INTERVAL_STAT_HIT( is, INTERVAL_STAT_ADD_INSIDE );
+                }
+        }
+}
+
+static void
+interval_list_remove( interval_set_t* is, int newLeft, int newRight )
+{
+
+        /*
+                Look up the interval nodes that newLeft and newRight are 
+                within the range of ( pointed to by lNode and rNode 
+                respectively). The value of the pointers is then used to 
+                determine how the range [newLeft, newRight) can be excluded 
+                from the interval set.
+         */
+
+        interval_t*     leftFloor = interval_set_floor_near( is, is->finger, newLeft );
+        interval_t*     rightFloor = interval_set_floor_near( is, leftFloor, newRight );
+        interval_t*     lNode = NULL;
+        interval_t*     rNode = NULL;
+
+        if ( leftFloor && newLeft <= leftFloor->right )
+        {
+                lNode = leftFloor;
+        }
+
+        if ( rightFloor && newRight <= rightFloor->right )
+        {
+                rNode = rightFloor;
+        }
+
+        if ( leftFloor )
+        {
+                is->finger = leftFloor;
+        }
+
+        if ( ( lNode && rNode ) && ( lNode != rNode ) )
+        {
+                /*
+                        When lNode and rNode are defined and are not equal to 
+                        eachother, this means 'newLeft' and 'newRight' are values 
+                        that exist in two different intervals in the set.
+
+                        We can then update those two nodes accordingly and
+                        delete all existing nodes inbetween ( including lNode
+                        or rNode themselves if they are covered completely ).
+                 */
+
+                interval_t*     first = lNode->next;
+                interval_t*     last = rNode->prev;
+
+                INTERVAL_STAT_HIT( is, INTERVAL_STAT_REMOVE_BOTH );
+
+                if ( lNode->left == newLeft )
+                {
+                        first = lNode;
+                }
+                else
+                {
+                        interval_list_resize( is, lNode, lNode->left, newLeft );
+                }
+
+                if ( rNode->right == newRight )
+                {
+                        last = rNode;
+                }
+                else
+                {
+                        interval_list_resize( is, rNode, newRight, rNode->right );
+                }
+
+                if ( first != last->next )
+                {
+                        interval_set_splice( is, first, last );
+                }
+        }
+        else if ( !lNode && rNode )
+        {
+                /*
+                        When lNode is not defined and rNode is, this means 
+                        'newLeft' exists outside of the intervals in the set 
+                        ( either below all of them or in between some of them )
+                        and 'newRight' exists WITHIN an interval in the set.
+
+                        We can update the node 'newRight' exists in accordingly 
+                        and remove all nodes between 'newLeft' and it.
+                 */
+
+                interval_t*     first = leftFloor ? leftFloor->next : is->head;
+                interval_t*     last = rNode->prev;
+
+                INTERVAL_STAT_HIT( is, INTERVAL_STAT_REMOVE_RIGHT );
+
+                if ( rNode->right == newRight )
+                {
+                        last = rNode;
+                }
+                else
+                {
+                        interval_list_resize( is, rNode, newRight, rNode->right );
+                }
+
+                if ( last && first != last->next )
+                {
+                        interval_set_splice( is, first, last );
+                }
+        }
+        else if ( lNode && !rNode )
+        {
+                /*
+                        This is the same as the previous else-if case except
+                        reversed: 'newLeft' exists WITHIN an interval in the
+                        set and 'newRight' exists outside of the intervals in 
+                        the set.
+
+                        Again, we can update the node 'newLeft' exists in 
+                        accordingly and remove all nodes between it and 
+                        'newRight'.
+                 */
+
+                interval_t*     first = lNode->next;
+
+                INTERVAL_STAT_HIT( is, INTERVAL_STAT_REMOVE_LEFT );
+
+                if ( lNode->left == newLeft )
+                {
+                        first = lNode;
+                }
+                else
+                {
+                        interval_list_resize( is, lNode, lNode->left, newLeft );
+                }
+
+                if ( first != rightFloor->next )
+                {
+                        interval_set_splice( is, first, rightFloor );
+                }
+        }
+        else if ( !lNode && !rNode )
+        {
+                /*
+                        If neither lNode or rNode is defined, then neither end 
+                        of the range [newLeft, newRight) falls inside an
+                        interval and we only need to delete the nodes that lie
+                        completely between them, if there are any.
+
+                        This includes the case where [newLeft, newRight) covers 
+                        the entire set, in which case the set is cleared in 
+                        place instead.
+                 */
+
+                interval_t*     first = leftFloor ? leftFloor->next : is->head;
+
+                INTERVAL_STAT_HIT( is, INTERVAL_STAT_REMOVE_NEITHER );
+
+                if ( first == is->head && rightFloor == is->tail )
+                {
+                        interval_list_clear( is );
+                }
+                else if ( rightFloor && first != rightFloor->next )
+                {
+                        interval_set_splice( is, first, rightFloor );
+                }
+        }
+        else if ( lNode == rNode )
+        {
+                /*
+                        If lNode and rNode are defined (which was checked by
+                        a previous if condition) and they are identical, then
+                        this means that the interval we are removing is inside 
+                        of an interval in the set. 
+
+                        In this case, there are four possible subcases that 
+                        need we need to check for.
+                 */
+
+                if ( lNode->left == newLeft && rNode->right == newRight )
+                {
+                        /*
+                                Case 1: [newLeft, newRight) covers the entire range of the 
+                                interval node, in which case we just need to delete it.
+                         */
+
+                        INTERVAL_STAT_HIT( is, INTERVAL_STAT_REMOVE_CASE1 );
+
+                        interval_set_delete_node( is, lNode );
+                }
+                else if ( lNode->left == newLeft && newRight <= lNode->right )
+                {
+                        /*
+                                Case 2: [newLeft, newRight) starts at the node's left 
+                                value and ends somewhere inside the interval range.
+                         */
+
+                        INTERVAL_STAT_HIT( is, INTERVAL_STAT_REMOVE_CASE2 );
+
+                        interval_list_resize( is, lNode, newRight, lNode->right );
+                }
+                else if ( lNode->left <= newLeft && newRight == lNode->right )
+                {
+                        /*
+                                Case 3: [newLeft, newRight) starts somwhere inside the 
+                                interval range and ends at the node's right value.
+                         */
+
+                        INTERVAL_STAT_HIT( is, INTERVAL_STAT_REMOVE_CASE3 );
+
+                        interval_list_resize( is, lNode, lNode->left, newLeft );
+                }
+                else if ( lNode->left < newLeft && newRight < lNode->right )
+                {
+                        /*
+                                Case 4: [newLeft, newRight) partially covers the range 
+                                of the interval node, in which case it must be
+                                split in to two nodes.
+                         */
+
+                        int     oldRight = lNode->right;
+
+                        INTERVAL_STAT_HIT( is, INTERVAL_STAT_REMOVE_CASE4 );
+
+                        interval_list_resize( is, lNode, lNode->left, newLeft );
+
+                        interval_set_insert_node( is, newRight, oldRight );
+                }
+        }
+}
+
+static size_t
+interval_array_lower_bound( const int* values, size_t count, int value )
+{
+        /*
+                Returns the index of the first element that is not less than
+                'value' ( or 'count' if there is none ).
+         */
+
+        size_t  lo = 0;
+        size_t  hi = count;
+
+        while ( lo < hi )
+        {
+                size_t  mid = lo + ( hi - lo ) / 2;
+
+                if ( values[mid] < value )
+                {
+                        lo = mid + 1;
+                }
+                else
+                {
+                        hi = mid;
+                }
+        }
+
+        return lo;
+}
+
+static size_t
+interval_array_upper_bound( const int* values, size_t count, int value )
+{
+        /*
+                Returns the index of the first element that is greater than
+                'value' ( or 'count' if there is none ).
+         */
+
+        size_t  lo = 0;
+        size_t  hi = count;
+
+        while ( lo < hi )
+        {
+                size_t  mid = lo + ( hi - lo ) / 2;
+
+                if ( values[mid] <= value )
+                {
+                        lo = mid + 1;
+                }
+                else
+                {
+                        hi = mid;
+                }
+        }
+
+        return lo;
+}
+
+static void
+interval_array_replace( interval_array_t* a, size_t first, size_t last, size_t replacements )
+{
+        /*
+                Makes room for exactly 'replacements' intervals in place of 
+                the intervals at indices [first, last), shifting the rest of 
+                both arrays with memmove. The caller fills in the new slots.
+         */
+
+        size_t  tail = a->count - last;
+        size_t  newCount = a->count - ( last - first ) + replacements;
+
+        if ( newCount > a->capacity )
+        {
+                size_t  capacity = a->capacity ? a->capacity * 2 : 16;
+
+                while ( capacity < newCount )
+                {
+                        capacity *= 2;
+                }
+
+                a->lefts = ( int* ) realloc( a->lefts, capacity * sizeof( int ) );
+                a->rights = ( int* ) realloc( a->rights, capacity * sizeof( int ) );
+                a->capacity = capacity;
+        }
+
+        memmove( &a->lefts[first + replacements], &a->lefts[last], tail * sizeof( int ) );
+        memmove( &a->rights[first + replacements], &a->rights[last], tail * sizeof( int ) );
+
+        a->count = newCount;
+}
+
+static void
+interval_array_push( interval_array_t* a, int newLeft, int newRight )
+{
+        /*
+                Appends [newLeft, newRight) to an array whose intervals all
+                start at or before 'newLeft', merging it into the last 
+                interval if the two overlap or touch.
+         */
+
+        if ( a->count && a->rights[a->count - 1] >= newLeft )
+        {
+                if ( a->rights[a->count - 1] < newRight )
+                {
+                        a->rights[a->count - 1] = newRight;
+                }
+
+                return;
+        }
+
+        interval_array_replace( a, a->count, a->count, 1 );
+
+        a->lefts[a->count - 1] = newLeft;
+        a->rights[a->count - 1] = newRight;
+}
+
+static void
+interval_array_add( interval_set_t* is, interval_array_t* a, int newLeft, int newRight )
+{
+        /*
+                Every interval from the first one ending at or after 'newLeft'
+                up to the last one starting at or before 'newRight' touches 
+                [newLeft, newRight), so that run is replaced by one interval
+                spanning all of them. Changes are reported to 'is' ( if not
+                NULL ) as the first interval of the run being resized and the
+                others deleted.
+         */
+
+        size_t  first = interval_array_lower_bound( a->rights, a->count, newLeft );
+        size_t  last = interval_array_upper_bound( a->lefts, a->count, newRight );
+
+        if ( first < last )
+        {
+                if ( a->lefts[first] < newLeft )
+                {
+                        newLeft = a->lefts[first];
+                }
+
+                if ( a->rights[last - 1] > newRight )
+                {
+                        newRight = a->rights[last - 1];
+                }
+
+                if ( a->lefts[first] != newLeft || a->rights[first] != newRight )
+                {
+                        interval_set_emit( is, INTERVAL_CHANGE_RESIZE, newLeft, newRight, a->lefts[first], a->rights[first] );
+                }
+
+                for ( size_t i = first + 1; i < last; i++ )
+                {
+                        interval_set_emit( is, INTERVAL_CHANGE_DELETE, a->lefts[i], a->rights[i], a->lefts[i], a->rights[i] );
+                }
+        }
+        else
+        {
+                interval_set_emit( is, INTERVAL_CHANGE_INSERT, newLeft, newRight, newLeft, newRight );
+        }
+
+        interval_array_replace( a, first, last, 1 );
+
+        a->lefts[first] = newLeft;
+        a->rights[first] = newRight;
+}
+
+static void
+interval_array_remove( interval_set_t* is, interval_array_t* a, int newLeft, int newRight )
+{
+        /*
+                The intervals overlapping [newLeft, newRight) are those from 
+                the first one ending after 'newLeft' up to the last one 
+                starting before 'newRight'. They are replaced by whatever is
+                left of the first one on the left side and of the last one on
+                the right side ( both, when a single interval gets split ).
+         */
+
+        size_t  first = interval_array_upper_bound( a->rights, a->count, newLeft );
+        size_t  last = interval_array_lower_bound( a->lefts, a->count, newRight );
+        size_t  n = 0;
+        int     keepLeft;
+        int     keepRight;
+        int     leftPiece;
+        int     rightPiece;
+
+        if ( first >= last )
+        {
+                return;
+        }
+
+        leftPiece = a->lefts[first];
+        rightPiece = a->rights[last - 1];
+        keepLeft = leftPiece < newLeft;
+        keepRight = rightPiece > newRight;
+
+        /*
+                Reported as the first and last intervals of the run being 
+                resized if something is left of them ( or the remainder on 
+                the right inserted, when a single interval is split ) and all
+                others deleted.
+         */
+
+        for ( size_t i = first; i < last; i++ )
+        {
+                int     oldLeft = a->lefts[i];
+                int     oldRight = a->rights[i];
+
+                if ( i == first && keepLeft )
+                {
+                        interval_set_emit( is, INTERVAL_CHANGE_RESIZE, oldLeft, newLeft, oldLeft, oldRight );
+
+                        if ( keepRight && i == last - 1 )
+                        {
+                                interval_set_emit( is, INTERVAL_CHANGE_INSERT, newRight, oldRight, newRight, oldRight );
+                        }
+                }
+                else if ( i == last - 1 && keepRight )
+                {
+                        interval_set_emit( is, INTERVAL_CHANGE_RESIZE, newRight, oldRight, oldLeft, oldRight );
+                }
+                else
+                {
+                        interval_set_emit( is, INTERVAL_CHANGE_DELETE, oldLeft, oldRight, oldLeft, oldRight );
+                }
+        }
+
+        interval_array_replace( a, first, last, keepLeft + keepRight );
+
+        if ( keepLeft )
+        {
+                a->lefts[first + n] = leftPiece;
+                a->rights[first + n] = newLeft;
+                n++;
+        }
+
+        if ( keepRight )
+        {
+                a->lefts[first + n] = newRight;
+                a->rights[first + n] = rightPiece;
+        }
+}
+
+static void
+interval_block_encode( interval_block_t* block, const int* lefts, const int* rights, size_t count )
+{
+        unsigned char   buf[INTERVAL_BLOCK_MAX_BYTES];
+        unsigned char*  p = buf;
+
+        for ( size_t i = 0; i < count; i++ )
+        {
+                if ( i )
+                {
+                        p = interval_varint_put( p, ( uint32_t ) lefts[i] - ( uint32_t ) rights[i - 1] );
+                }
+
+                p = interval_varint_put( p, ( uint32_t ) rights[i] - ( uint32_t ) lefts[i] );
+        }
+
+        block->first = lefts[0];
+        block->count = ( uint32_t ) count;
+        block->size = ( uint32_t ) ( p - buf );
+        block->data = ( unsigned char* ) realloc( block->data, block->size );
+
+        memcpy( block->data, buf, block->size );
+}
+
+static size_t
+interval_blocks_find( const interval_blocks_t* bs, int value )
+{
+        /*
+                Returns the index of the last block starting at or before 
+                'value', or 0 if there is none.
+         */
+
+        size_t  lo = 0;
+        size_t  hi = bs->count;
+
+        while ( lo < hi )
+        {
+                size_t  mid = lo + ( hi - lo ) / 2;
+
+                if ( bs->blocks[mid].first <= value )
+                {
+                        lo = mid + 1;
+                }
+                else
+                {
+                        hi = mid;
+                }
+        }
+
+        return lo ? lo - 1 : 0;
+}
+
+static void
+interval_blocks_rewrite( interval_blocks_t* bs, size_t first, size_t last, const interval_array_t* a )
+{
+        /*
+                Replaces the blocks [first, last) with the intervals of 'a',
+                spread evenly over as few blocks as will hold them.
+         */
+
+        size_t  needed = ( a->count + INTERVAL_BLOCK_INTERVALS - 1 ) / INTERVAL_BLOCK_INTERVALS;
+        size_t  removed = last - first;
+        size_t  newCount = bs->count - removed + needed;
+        size_t  done = 0;
+
+        for ( size_t i = needed; i < removed; i++ )
+        {
+                free( bs->blocks[first + i].data );
+        }
+
+        if ( newCount > bs->capacity )
+        {
+                bs->capacity = bs->capacity ? bs->capacity * 2 : 16;
+
+                while ( bs->capacity < newCount )
+                {
+                        bs->capacity *= 2;
+                }
+
+                bs->blocks = ( interval_block_t* ) realloc( bs->blocks, bs->capacity * sizeof( interval_block_t ) );
+        }
+
+        if ( needed != removed )
+        {
+                /*
+                        Blocks being reused keep their data pointers ( to be
+                        realloc'd ), new ones start out without any.
+                 */
+
+                size_t  kept = needed < removed ? needed : removed;
+
+                memmove( &bs->blocks[first + needed], &bs->blocks[last], ( bs->count - last ) * sizeof( interval_block_t ) );
+
+                for ( size_t i = kept; i < needed; i++ )
+                {
+                        bs->blocks[first + i].data = NULL;
+                }
+        }
+
+        for ( size_t i = 0; i < needed; i++ )
+        {
+                size_t  take = ( a->count - done ) / ( needed - i );
+
+                interval_block_encode( &bs->blocks[first + i], &a->lefts[done], &a->rights[done], take );
+                done += take;
+        }
+
+        bs->count = newCount;
+}
+
+static void
+interval_blocks_build( interval_set_t* is, const int* lefts, const int* rights, size_t count )
+{
+        /*
+                Replaces the contents of a block set with intervals that are 
+                already sorted, disjoint and not touching.
+         */
+
+        interval_array_t        a = { ( int* ) lefts, ( int* ) rights, count, count };
+
+        interval_blocks_rewrite( &is->blocks, 0, is->blocks.count, &a );
+
+        is->blocks.intervals = count;
+}
+
+static void
+interval_blocks_update( interval_set_t* is, int newLeft, int newRight, int kind )
+{
+        /*
+                Only the blocks from the one holding the interval that could
+                contain or touch 'newLeft' to the one holding the interval 
+                that could contain or touch 'newRight' are affected. They are
+                decoded, updated like the array backend and written back. A
+                run that shrank below a quarter of a block takes in the next
+                block, so that blocks don't stay nearly empty.
+         */
+
+        interval_blocks_t*      bs = &is->blocks;
+        interval_array_t        a = { 0 };
+        size_t                  first = interval_blocks_find( bs, newLeft );
+        size_t                  last = interval_blocks_find( bs, newRight ) + 1;
+        interval_block_cursor_t c;
+        int                     left;
+        int                     right;
+
+        if ( last > bs->count )
+        {
+                last = bs->count;
+        }
+
+        for ( size_t i = first; i < last; i++ )
+        {
+                interval_block_open( &c, &bs->blocks[i] );
+
+                while ( interval_block_read( &c, &left, &right ) )
+                {
+                        interval_array_push( &a, left, right );
+                }
+        }
+
+        bs->intervals -= a.count;
+
+        if ( kind == INTERVAL_OP_ADD )
+        {
+                interval_array_add( is, &a, newLeft, newRight );
+        }
+        else
+        {
+                interval_array_remove( is, &a, newLeft, newRight );
+        }
+
+        if ( a.count < INTERVAL_BLOCK_INTERVALS / 4 && last < bs->count )
+        {
+                /*
+                        The next block's intervals all start after the ones 
+                        we have, so they can be appended.
+                 */
+
+                bs->intervals -= bs->blocks[last].count;
+
+                interval_block_open( &c, &bs->blocks[last++] );
+
+                while ( interval_block_read( &c, &left, &right ) )
+                {
+                        interval_array_push( &a, left, right );
+                }
+        }
+
+        bs->intervals += a.count;
+
+        interval_blocks_rewrite( bs, first, last, &a );
+
+        free( a.lefts );
+        free( a.rights );
+}
+
+static int
+interval_blocks_floor( interval_blocks_t* bs, int value, int* left, int* right )
+{
+        /*
+                Finds the interval with the greatest left value at or before
+                'value', returning 0 if there is none.
+         */
+
+        interval_block_cursor_t c;
+        int                     l;
+        int                     r;
+        int                     found = 0;
+
+        if ( !bs->count )
+        {
+                return 0;
+        }
+
+        interval_block_open( &c, &bs->blocks[interval_blocks_find( bs, value )] );
+
+        while ( interval_block_read( &c, &l, &r ) && l <= value )
+        {
+                *left = l;
+                *right = r;
+                found = 1;
+        }
+
+        return found;
+}
+
+static interval_array_t
+interval_set_flatten( interval_set_t* is, int* owned )
+{
+        /*
+                Returns the intervals of the set as sorted arrays: the set's
+                own arrays for the array backend, or a copy ( that the caller
+                must free, flagged by 'owned' ) for the list backend.
+         */
+
+        interval_array_t        a = { 0 };
+        interval_iter_t         it;
+        int                     left;
+        int                     right;
+
+        interval_set_flush( is );
+
+        if ( is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                *owned = 0;
+
+                return is->array;
+        }
+
+        *owned = 1;
+
+        interval_iter_begin( &it, is );
+
+        while ( interval_iter_next( &it, &left, &right ) )
+        {
+                interval_array_push( &a, left, right );
+        }
+
+        return a;
+}
+
+static void
+interval_set_emit_diff( interval_set_t* is, const interval_array_t* before, const interval_array_t* after )
+{
+        /*
+                Reports the intervals only in 'before' as deleted and those
+                only in 'after' as inserted.
+         */
+
+        size_t  i = 0;
+        size_t  k = 0;
+
+        while ( i < before->count || k < after->count )
+        {
+                if ( i < before->count && k < after->count && before->lefts[i] == after->lefts[k] && before->rights[i] == after->rights[k] )
+                {
+                        i++;
+                        k++;
+                }
+                else if ( i < before->count && ( k == after->count || before->lefts[i] <= after->lefts[k] ) )
+                {
+                        interval_set_emit( is, INTERVAL_CHANGE_DELETE, before->lefts[i], before->rights[i], before->lefts[i], before->rights[i] );
+                        i++;
+                }
+                else
+                {
+                        interval_set_emit( is, INTERVAL_CHANGE_INSERT, after->lefts[k], after->rights[k], after->lefts[k], after->rights[k] );
+                        k++;
+                }
+        }
+}
+
+static void
+interval_chunk_clear( interval_chunk_t* c )
+{
+        free( c->bitmap );
+        free( c->array.lefts );
+        free( c->array.rights );
+
+        c->bitmap = NULL;
+        memset( &c->array, 0, sizeof( interval_array_t ) );
+        c->span = 0;
+        c->runs = 0;
+}
+
+static int
+interval_bitmap_starts( const uint64_t* words, int from, int to )
+{
+        /*
+                Counts the runs starting in words [from, to): the set bits 
+                whose previous bit is clear.
+         */
+
+        int     starts = 0;
+
+        for ( int i = from; i < to; i++ )
+        {
+                uint64_t        carry = i ? words[i - 1] >> 63 : 0;
+
+                starts += __builtin_popcountll( words[i] & ~( ( words[i] << 1 ) | carry ) );
+        }
+
+        return starts;
+}
+
+static void
+interval_bitmap_fill( uint64_t* words, int lo, int hi, int set )
+{
+        /*
+                Sets or clears the bits [lo, hi): masks for the partial words
+                at either end, and memset for the whole words in between.
+         */
+
+        int             first = lo >> 6;
+        int             last = ( hi - 1 ) >> 6;
+        uint64_t        firstMask = ~0ull << ( lo & 63 );
+        uint64_t        lastMask = ~0ull >> ( 63 - ( ( hi - 1 ) & 63 ) );
+
+        if ( first == last )
+        {
+                firstMask &= lastMask;
+                lastMask = 0;
+        }
+        else
+        {
+                memset( &words[first + 1], set ? 0xFF : 0, ( last - first - 1 ) * sizeof( uint64_t ) );
+        }
+
+        if ( set )
+        {
+                words[first] |= firstMask;
+                words[last] |= lastMask;
+        }
+        else
+        {
+                words[first] &= ~firstMask;
+                words[last] &= ~lastMask;
+        }
+}
+
+static void
+interval_chunk_fill( interval_chunk_t* c, int lo, int hi, int set )
+{
+        /*
+                Adds or removes [lo, hi) ( in chunk coordinates ) and then
+                switches the chunk's container if its run count crossed a 
+                limit. A bitmap keeps its run count up to date by counting 
+                the runs in the words it changes ( and the word after ) 
+                before and after the change.
+         */
+
+        if ( c->bitmap )
+        {
+                int     from = lo >> 6;
+                int     to = ( ( hi - 1 ) >> 6 ) + 2;
+                int     before;
+
+                if ( to > INTERVAL_CHUNK_WORDS )
+                {
+                        to = INTERVAL_CHUNK_WORDS;
+                }
+
+                before = interval_bitmap_starts( c->bitmap, from, to );
+                interval_bitmap_fill( c->bitmap, lo, hi, set );
+                c->runs += interval_bitmap_starts( c->bitmap, from, to ) - before;
+        }
+        else
+        {
+                if ( set )
+                {
+                        interval_array_add( NULL, &c->array, lo, hi );
+                }
+                else
+                {
+                        interval_array_remove( NULL, &c->array, lo, hi );
+                }
+
+                c->runs = ( int ) c->array.count;
+        }
+
+        if ( !c->bitmap && c->runs > INTERVAL_CHUNK_MAX_RUNS )
+        {
+                uint64_t*       bitmap = ( uint64_t* ) calloc( INTERVAL_CHUNK_WORDS, sizeof( uint64_t ) );
+                int             runs = c->runs;
+
+                for ( size_t i = 0; i < c->array.count; i++ )
+                {
+                        interval_bitmap_fill( bitmap, c->array.lefts[i], c->array.rights[i], 1 );
+                }
+
+                interval_chunk_clear( c );
+                c->bitmap = bitmap;
+                c->runs = runs;
+        }
+        else if ( c->bitmap && c->runs < INTERVAL_CHUNK_MIN_RUNS )
+        {
+                interval_array_t        a = { 0 };
+                size_t                  offset = 0;
+                int                     l;
+                int                     r;
+
+                while ( interval_chunk_next( c, &offset, &l, &r ) )
+                {
+                        interval_array_push( &a, l, r );
+                }
+
+                interval_chunk_clear( c );
+                c->array = a;
+                c->runs = ( int ) a.count;
+        }
+}
+
+static int
+interval_chunk_edge( const interval_chunk_t* c, int end )
+{
+        /*
+                Whether the chunk's first value ( or last, for 'end' ) is in 
+                the set.
+         */
+
+        if ( c->span )
+        {
+                return 1;
+        }
+
+        if ( c->bitmap )
+        {
+                return end ? ( int ) ( c->bitmap[INTERVAL_CHUNK_WORDS - 1] >> 63 ) : ( int ) ( c->bitmap[0] & 1 );
+        }
+
+        return end ? c->array.rights[c->array.count - 1] == INTERVAL_CHUNK_SIZE : c->array.lefts[0] == 0;
+}
+
+static size_t
+interval_chunks_lower_bound( const interval_chunks_t* cs, int key )
+{
+        /*
+                Finds the first chunk that reaches 'key': the one holding it 
+                ( a span may start before it ), or else the one after it.
+         */
+
+        size_t  lo = 0;
+        size_t  hi = cs->count;
+
+        while ( lo < hi )
+        {
+                size_t  mid = lo + ( hi - lo ) / 2;
+
+                if ( interval_chunk_last( &cs->chunks[mid] ) < key )
+                {
+                        lo = mid + 1;
+                }
+                else
+                {
+                        hi = mid;
+                }
+        }
+
+        return lo;
+}
+
+static void
+interval_chunks_splice( interval_chunks_t* cs, size_t i, size_t j, const interval_chunk_t* run, size_t n )
+{
+        /*
+                Replaces the chunks [i, j) with the 'n' chunks of 'run'.
+         */
+
+        size_t  newCount = cs->count - ( j - i ) + n;
+
+        if ( newCount > cs->capacity )
+        {
+                cs->capacity = cs->capacity ? cs->capacity * 2 : 16;
+
+                while ( cs->capacity < newCount )
+                {
+                        cs->capacity *= 2;
+                }
+
+                cs->chunks = ( interval_chunk_t* ) realloc( cs->chunks, cs->capacity * sizeof( interval_chunk_t ) );
+        }
+
+        memmove( &cs->chunks[i + n], &cs->chunks[j], ( cs->count - j ) * sizeof( interval_chunk_t ) );
+        memcpy( &cs->chunks[i], run, n * sizeof( interval_chunk_t ) );
+        cs->count = newCount;
+}
+
+static void
+interval_chunks_split( interval_chunks_t* cs, int key )
+{
+        /*
+                Splits the span holding 'key' ( if any ) so that one of its 
+                parts starts at 'key'.
+         */
+
+        size_t                  i = interval_chunks_lower_bound( cs, key );
+        interval_chunk_t        parts[2];
+
+        if ( i == cs->count || !cs->chunks[i].span || cs->chunks[i].key >= key )
+        {
+                return;
+        }
+
+        parts[0] = cs->chunks[i];
+        parts[1] = cs->chunks[i];
+        parts[0].span = key - parts[0].key;
+        parts[1].key = key;
+        parts[1].span -= parts[0].span;
+
+        interval_chunks_splice( cs, i, i + 1, parts, 2 );
+}
+
+static void
+interval_chunks_unpack( interval_chunks_t* cs, int key )
+{
+        /*
+                Turns the chunk 'key' into a chunk of its own holding a single
+                full run, if it's part of a span, so that it can be cleared 
+                partially.
+         */
+
+        size_t                  i;
+        interval_chunk_t*       c;
+
+        interval_chunks_split( cs, key );
+        interval_chunks_split( cs, key + 1 );
+
+        i = interval_chunks_lower_bound( cs, key );
+        c = &cs->chunks[i];
+
+        if ( i < cs->count && c->span && c->key == key )
+        {
+                c->span = 0;
+                interval_array_push( &c->array, 0, INTERVAL_CHUNK_SIZE );
+                c->runs = 1;
+        }
+}
+
+static void
+interval_chunks_apply( interval_chunks_t* cs, int newLeft, int newRight, int set )
+{
+        /*
+                Chunks that [newLeft, newRight) covers completely become part
+                of a single span ( on add ) or are dropped ( on remove ), and 
+                only the chunks at either end are filled in or cleared 
+                partially. Spans are first split at the edges of the range. 
+                On add, the chunks of the range ( and any spans right next to
+                it ) are replaced by at most three in one move: the partial 
+                chunks at either end and a span between them. On remove, the
+                chunks left over are compacted in place.
+         */
+
+        uint32_t        first = ( uint32_t ) newLeft ^ 0x80000000u;
+        uint32_t        last = ( uint32_t ) ( newRight - 1 ) ^ 0x80000000u;
+        int             firstKey = ( int ) ( first >> INTERVAL_CHUNK_BITS );
+        int             lastKey = ( int ) ( last >> INTERVAL_CHUNK_BITS );
+        int             lo = ( int ) ( first & ( INTERVAL_CHUNK_SIZE - 1 ) );
+        int             hi = ( int ) ( last & ( INTERVAL_CHUNK_SIZE - 1 ) ) + 1;
+        size_t          i;
+        size_t          j;
+
+        interval_chunks_split( cs, firstKey );
+        interval_chunks_split( cs, lastKey + 1 );
+
+        if ( set )
+        {
+                interval_chunk_t        run[3];
+                interval_chunk_t        ends[2];
+                int                     partial[2] = { 0, 0 };
+                int                     from = firstKey;
+                int                     to = lastKey;
+                size_t                  n = 0;
+
+                i = interval_chunks_lower_bound( cs, firstKey );
+                j = interval_chunks_lower_bound( cs, lastKey + 1 );
+
+                /*
+                        The chunks at either end, if the range covers them only
+                        partially, are filled in on their own; those that end 
+                        up full join the span.
+                 */
+
+                for ( int e = 0; e < 2; e++ )
+                {
+                        int     key = e ? lastKey : firstKey;
+                        size_t  k = e ? j - 1 : i;
+                        int     l = key == firstKey ? lo : 0;
+                        int     h = key == lastKey ? hi : INTERVAL_CHUNK_SIZE;
+
+                        if ( ( l == 0 && h == INTERVAL_CHUNK_SIZE ) || ( e && firstKey == lastKey ) )
+                        {
+                                continue;
+                        }
+
+                        memset( &ends[e], 0, sizeof( interval_chunk_t ) );
+                        ends[e].key = key;
+
+                        if ( k >= i && k < j && cs->chunks[k].key <= key && interval_chunk_last( &cs->chunks[k] ) >= key )
+                        {
+                                if ( cs->chunks[k].span )
+                                {
+                                        continue;
+                                }
+
+                                ends[e] = cs->chunks[k];
+                                memset( &cs->chunks[k], 0, sizeof( interval_chunk_t ) );
+                        }
+
+                        interval_chunk_fill( &ends[e], l, h, 1 );
+
+                        if ( ends[e].runs == 1 && interval_chunk_edge( &ends[e], 0 ) && interval_chunk_edge( &ends[e], 1 ) )
+                        {
+                                interval_chunk_clear( &ends[e] );
+                                continue;
+                        }
+
+                        partial[e] = 1;
+
+                        if ( e )
+                        {
+                                to--;
+                        }
+                        else
+                        {
+                                from++;
+                        }
+                }
+
+                for ( size_t k = i; k < j; k++ )
+                {
+                        interval_chunk_clear( &cs->chunks[k] );
+                }
+
+                if ( partial[0] )
+                {
+                        run[n++] = ends[0];
+                }
+
+                if ( from <= to )
+                {
+                        memset( &run[n], 0, sizeof( interval_chunk_t ) );
+                        run[n].key = from;
+                        run[n].span = to - from + 1;
+
+                        if ( i && cs->chunks[i - 1].span && interval_chunk_last( &cs->chunks[i - 1] ) == from - 1 )
+                        {
+                                i--;
+                                run[n].key = cs->chunks[i].key;
+                                run[n].span += cs->chunks[i].span;
+                        }
+
+                        if ( j < cs->count && cs->chunks[j].span && cs->chunks[j].key == to + 1 )
+                        {
+                                run[n].span += cs->chunks[j].span;
+                                j++;
+                        }
+
+                        n++;
+                }
+
+                if ( partial[1] )
+                {
+                        run[n++] = ends[1];
+                }
+
+                interval_chunks_splice( cs, i, j, run, n );
+        }
+        else
+        {
+                size_t  out;
+
+                if ( lo )
+                {
+                        interval_chunks_unpack( cs, firstKey );
+                }
+
+                if ( hi < INTERVAL_CHUNK_SIZE )
+                {
+                        interval_chunks_unpack( cs, lastKey );
+                }
+
+                i = interval_chunks_lower_bound( cs, firstKey );
+                j = interval_chunks_lower_bound( cs, lastKey + 1 );
+                out = i;
+
+                for ( size_t k = i; k < j; k++ )
+                {
+                        interval_chunk_t*       c = &cs->chunks[k];
+                        int                     l = c->key == firstKey ? lo : 0;
+                        int                     h = c->key == lastKey ? hi : INTERVAL_CHUNK_SIZE;
+
+                        if ( c->span || ( l == 0 && h == INTERVAL_CHUNK_SIZE ) )
+                        {
+                                interval_chunk_clear( c );
+                        }
+                        else
+                        {
+                                interval_chunk_fill( c, l, h, 0 );
+                        }
+
+                        if ( c->runs )
+                        {
+                                cs->chunks[out++] = *c;
+                        }
+                        else
+                        {
+                                interval_chunk_clear( c );
+                        }
+                }
+
+                memmove( &cs->chunks[out], &cs->chunks[j], ( cs->count - j ) * sizeof( interval_chunk_t ) );
+                cs->count -= j - out;
+        }
+}
+
+static void
+interval_chunks_collect( interval_set_t* is, int newLeft, int newRight, interval_array_t* out )
+{
+        /*
+                Collects the intervals of a hybrid set that overlap or touch
+                [newLeft, newRight]. The walk starts at the chunk before the
+                one holding 'newLeft', backing up over chunks that continue
+                an interval from the chunk before them.
+         */
+
+        interval_chunks_t*      cs = &is->chunks;
+        interval_iter_t         it;
+        size_t                  start = interval_chunks_lower_bound( cs, ( int ) ( ( ( uint32_t ) newLeft ^ 0x80000000u ) >> INTERVAL_CHUNK_BITS ) );
+        int                     left;
+        int                     right;
+
+        if ( start )
+        {
+                start--;
+        }
+
+        while ( start && interval_chunk_last( &cs->chunks[start - 1] ) == cs->chunks[start].key - 1
+                        && interval_chunk_edge( &cs->chunks[start], 0 )
+                        && interval_chunk_edge( &cs->chunks[start - 1], 1 ) )
+        {
+                start--;
+        }
+
+        interval_iter_begin( &it, is );
+        it.index = start;
+
+        while ( interval_iter_next( &it, &left, &right ) && left <= newRight )
+        {
+                if ( right >= newLeft )
+                {
+                        interval_array_push( out, left, right );
+                }
+        }
+}
+
+static void
+interval_chunks_update( interval_set_t* is, int newLeft, int newRight, int set )
+{
+        /*
+                With a change feed, the intervals around the range are 
+                collected before and after the change and diffed, since a 
+                change to the chunks doesn't map onto whole intervals.
+         */
+
+        interval_array_t        before = { 0 };
+        interval_array_t        after = { 0 };
+        int                     feed = is->feed || is->feedBuffer;
+
+        if ( feed )
+        {
+                interval_chunks_collect( is, newLeft, newRight, &before );
+        }
+
+        interval_chunks_apply( &is->chunks, newLeft, newRight, set );
+
+        if ( feed )
+        {
+                interval_chunks_collect( is, newLeft, newRight, &after );
+                interval_set_emit_diff( is, &before, &after );
+
+                free( before.lefts );
+                free( before.rights );
+                free( after.lefts );
+                free( after.rights );
+        }
+}
+
+static void
+interval_chunks_build( interval_set_t* is, const int* lefts, const int* rights, size_t count )
+{
+        /*
+                Replaces the contents of a hybrid set with intervals that are
+                already sorted, disjoint and not touching.
+         */
+
+        for ( size_t i = 0; i < is->chunks.count; i++ )
+        {
+                interval_chunk_clear( &is->chunks.chunks[i] );
+        }
+
+        is->chunks.count = 0;
+
+        for ( size_t i = 0; i < count; i++ )
+        {
+                interval_chunks_apply( &is->chunks, lefts[i], rights[i], 1 );
+        }
+}
+
+static int
+interval_chunks_contains( const interval_chunks_t* cs, int value )
+{
+        uint32_t                point = ( uint32_t ) value ^ 0x80000000u;
+        size_t                  i = interval_chunks_lower_bound( cs, ( int ) ( point >> INTERVAL_CHUNK_BITS ) );
+        const interval_chunk_t* c = &cs->chunks[i];
+        int                     local = ( int ) ( point & ( INTERVAL_CHUNK_SIZE - 1 ) );
+
+        if ( i == cs->count || c->key > ( int ) ( point >> INTERVAL_CHUNK_BITS ) )
+        {
+                return 0;
+        }
+
+        if ( c->span )
+        {
+                return 1;
+        }
+
+        if ( c->bitmap )
+        {
+                return ( int ) ( ( c->bitmap[local >> 6] >> ( local & 63 ) ) & 1 );
+        }
+
+        i = interval_array_upper_bound( c->array.lefts, c->array.count, local );
+
+        return i > 0 && local < c->array.rights[i - 1];
+}
+
+static int
+interval_chunks_overlaps( const interval_chunks_t* cs, int newLeft, int newRight )
+{
+        /*
+                Checks the chunks in the range until one has a value in it:
+                a bitmap a word at a time, runs with a binary search.
+         */
+
+        uint32_t        first = ( uint32_t ) newLeft ^ 0x80000000u;
+        uint32_t        last = ( uint32_t ) ( newRight - 1 ) ^ 0x80000000u;
+        int             firstKey = ( int ) ( first >> INTERVAL_CHUNK_BITS );
+        int             lastKey = ( int ) ( last >> INTERVAL_CHUNK_BITS );
+
+        for ( size_t k = interval_chunks_lower_bound( cs, firstKey ); k < cs->count && cs->chunks[k].key <= lastKey; k++ )
+        {
+                const interval_chunk_t* c = &cs->chunks[k];
+                int                     lo = c->key == firstKey ? ( int ) ( first & ( INTERVAL_CHUNK_SIZE - 1 ) ) : 0;
+                int                     hi = c->key == lastKey ? ( int ) ( last & ( INTERVAL_CHUNK_SIZE - 1 ) ) + 1 : INTERVAL_CHUNK_SIZE;
+
+                if ( c->span )
+                {
+                        return 1;
+                }
+
+                if ( c->bitmap )
+                {
+                        int             w = lo >> 6;
+                        int             lastWord = ( hi - 1 ) >> 6;
+                        uint64_t        mask = ~0ull << ( lo & 63 );
+
+                        for ( ; w <= lastWord; w++, mask = ~0ull )
+                        {
+                                if ( w == lastWord )
+                                {
+                                        mask &= ~0ull >> ( 63 - ( ( hi - 1 ) & 63 ) );
+                                }
+
+                                if ( c->bitmap[w] & mask )
+                                {
+                                        return 1;
+                                }
+                        }
+                }
+                else
+                {
+                        size_t  i = interval_array_lower_bound( c->array.lefts, c->array.count, hi );
+
+                        if ( i > 0 && lo < c->array.rights[i - 1] )
+                        {
+                                return 1;
+                        }
+                }
+        }
+
+        return 0;
+}
+
+static int
+interval_chunk_floor( const interval_chunk_t* c, int local, int* lo, int* hi )
+{
+        /*
+                Finds the run of a chunk with the greatest start at or before
+                'local', in chunk coordinates, returning 0 if there is none.
+                A bitmap is scanned backwards a word at a time for the last 
+                set bit, and then for the clear bit before it.
+         */
+
+        int             w = local >> 6;
+        int             last;
+        uint64_t        bits;
+        size_t          offset;
+
+        if ( !c->bitmap )
+        {
+                size_t  i = interval_array_upper_bound( c->array.lefts, c->array.count, local );
+
+                if ( !i )
+                {
+                        return 0;
+                }
+
+                *lo = c->array.lefts[i - 1];
+                *hi = c->array.rights[i - 1];
+
+                return 1;
+        }
+
+        bits = c->bitmap[w] & ( ~0ull >> ( 63 - ( local & 63 ) ) );
+
+        while ( !bits )
+        {
+                if ( !w )
+                {
+                        return 0;
+                }
+
+                bits = c->bitmap[--w];
+        }
+
+        last = w * 64 + 63 - __builtin_clzll( bits );
+        bits = ~c->bitmap[w] & ( ( last & 63 ) ? ~0ull >> ( 64 - ( last & 63 ) ) : 0 );
+
+        while ( !bits && w )
+        {
+                bits = ~c->bitmap[--w];
+        }
+
+        offset = bits ? ( size_t ) ( w * 64 + 64 - __builtin_clzll( bits ) ) : 0;
+
+        return interval_chunk_next( c, &offset, lo, hi );
+}
+
+static void
+interval_chunks_extend( const interval_chunks_t* cs, size_t index, int lo, int* left, int* right )
+{
+        /*
+                Widens the run [lo, ...) of chunk 'index', whose bounds are 
+                passed in set coordinates, to the whole interval: back while
+                it starts its chunk and the chunk before is adjacent and ends
+                in the set, forward while the runs that follow continue it.
+         */
+
+        size_t  offset = 0;
+        size_t  next = index + 1;
+        int     l;
+        int     r;
+        int     hi;
+
+        while ( lo == 0 && index > 0 && interval_chunk_last( &cs->chunks[index - 1] ) == cs->chunks[index].key - 1 && interval_chunk_edge( &cs->chunks[index - 1], 1 ) )
+        {
+                index--;
+
+                if ( !cs->chunks[index].span )
+                {
+                        interval_chunk_floor( &cs->chunks[index], INTERVAL_CHUNK_SIZE - 1, &lo, &hi );
+                }
+
+                *left = interval_chunk_value( cs->chunks[index].key, lo );
+        }
+
+        while ( interval_chunks_read( cs, &next, &offset, &l, &r ) && l == *right )
+        {
+                *right = r;
+        }
+}
+
+static int
+interval_chunks_floor( const interval_chunks_t* cs, int value, int* left, int* right )
+{
+        /*
+                Finds the interval with the greatest left value at or before
+                'value', returning 0 if there is none.
+         */
+
+        uint32_t        point = ( uint32_t ) value ^ 0x80000000u;
+        int             key = ( int ) ( point >> INTERVAL_CHUNK_BITS );
+        size_t          i = interval_chunks_lower_bound( cs, key );
+        int             local = ( int ) ( point & ( INTERVAL_CHUNK_SIZE - 1 ) );
+        int             lo = 0;
+        int             hi;
+
+        if ( i == cs->count || cs->chunks[i].key > key || ( !cs->chunks[i].span && !interval_chunk_floor( &cs->chunks[i], local, &lo, &hi ) ) )
+        {
+                if ( !i )
+                {
+                        return 0;
+                }
+
+                i--;
+
+                if ( !cs->chunks[i].span )
+                {
+                        interval_chunk_floor( &cs->chunks[i], INTERVAL_CHUNK_SIZE - 1, &lo, &hi );
+                }
+        }
+
+        *left = interval_chunk_value( cs->chunks[i].key, lo );
+        *right = cs->chunks[i].span ? interval_chunk_end( &cs->chunks[i] ) : interval_chunk_value( cs->chunks[i].key, hi );
+        interval_chunks_extend( cs, i, lo, left, right );
+
+        return 1;
+}
+
+static int
+interval_chunks_ceiling( const interval_chunks_t* cs, int value, int* left, int* right )
+{
+        /*
+                Finds the first interval ending after 'value' ( the one that
+                contains it, or else the next one ), returning 0 if there is
+                none.
+         */
+
+        uint32_t        point = ( uint32_t ) value ^ 0x80000000u;
+        int             key = ( int ) ( point >> INTERVAL_CHUNK_BITS );
+        size_t          i = interval_chunks_lower_bound( cs, key );
+        int             local = ( int ) ( point & ( INTERVAL_CHUNK_SIZE - 1 ) );
+        size_t          offset = 0;
+        int             lo;
+        int             hi;
+
+        if ( i < cs->count && cs->chunks[i].key <= key )
+        {
+                const interval_chunk_t* c = &cs->chunks[i];
+
+                if ( c->span )
+                {
+                        *left = interval_chunk_value( c->key, 0 );
+                        *right = interval_chunk_end( c );
+                        interval_chunks_extend( cs, i, 0, left, right );
+
+                        return 1;
+                }
+
+                if ( interval_chunk_floor( c, local, &lo, &hi ) && hi > local )
+                {
+                        *left = interval_chunk_value( c->key, lo );
+                        *right = interval_chunk_value( c->key, hi );
+                        interval_chunks_extend( cs, i, lo, left, right );
+
+                        return 1;
+                }
+
+                offset = c->bitmap ? ( size_t ) local : interval_array_upper_bound( c->array.lefts, c->array.count, local );
+        }
+
+        /*
+                'value' is not in the set, so the next run starts a new 
+                interval and only needs widening forward.
+         */
+
+        if ( !interval_chunks_read( cs, &i, &offset, left, right ) )
+        {
+                return 0;
+        }
+
+        lo = ( int ) ( ( ( uint32_t ) *left ^ 0x80000000u ) & ( INTERVAL_CHUNK_SIZE - 1 ) );
+        interval_chunks_extend( cs, i, lo, left, right );
+
+        return 1;
+}
+
+void
+interval_set_clear( interval_set_t* is )
+{
+        /*
+                Empties the set. The list backend drops all of its nodes in 
+                O(1) and the array backend just forgets its intervals, both 
+                keeping their memory for what gets added next. The block and
+                hybrid backends free each block or chunk. With a change feed,
+                every interval is reported as deleted first.
+         */
+
+        interval_set_flush( is );
+
+        is->modifications++;
+
+        if ( is->backend == INTERVAL_BACKEND_LIST )
+        {
+                interval_list_clear( is );
+                return;
+        }
+
+        if ( is->feed || is->feedBuffer )
+        {
+                interval_iter_t         it;
+                int                     left;
+                int                     right;
+
+                interval_iter_begin( &it, is );
+
+                while ( interval_iter_next( &it, &left, &right ) )
+                {
+                        interval_set_emit( is, INTERVAL_CHANGE_DELETE, left, right, left, right );
+                }
+        }
+
+        if ( is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                is->array.count = 0;
+        }
+        else if ( is->backend == INTERVAL_BACKEND_BLOCK )
+        {
+                for ( size_t i = 0; i < is->blocks.count; i++ )
+                {
+                        free( is->blocks.blocks[i].data );
+                }
+
+                is->blocks.count = 0;
+                is->blocks.intervals = 0;
+        }
+        else if ( is->backend == INTERVAL_BACKEND_HYBRID )
+        {
+                for ( size_t i = 0; i < is->chunks.count; i++ )
+                {
+                        interval_chunk_clear( &is->chunks.chunks[i] );
+                }
+
+                is->chunks.count = 0;
+        }
+}
+
+static void
+interval_set_assign( interval_set_t* is, interval_array_t* result )
+{
+        /*
+                Replaces the contents of the set with 'result' ( sorted, 
+                disjoint and not touching ), taking ownership of its arrays.
+                With a change feed, the old and new contents are diffed so
+                that only intervals that differ are reported.
+         */
+
+        is->modifications++;
+
+        if ( is->feed || is->feedBuffer )
+        {
+                int                     owned;
+                interval_array_t        before = interval_set_flatten( is, &owned );
+
+                interval_set_emit_diff( is, &before, result );
+
+                if ( owned )
+                {
+                        free( before.lefts );
+                        free( before.rights );
+                }
+        }
+
+        if ( is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                free( is->array.lefts );
+                free( is->array.rights );
+                is->array = *result;
+        }
+        else if ( is->backend == INTERVAL_BACKEND_BLOCK )
+        {
+                interval_blocks_build( is, result->lefts, result->rights, result->count );
+
+                free( result->lefts );
+                free( result->rights );
+        }
+        else if ( is->backend == INTERVAL_BACKEND_HYBRID )
+        {
+                interval_chunks_build( is, result->lefts, result->rights, result->count );
+
+                free( result->lefts );
+                free( result->rights );
+        }
+        else
+        {
+                interval_list_reset( is );
+                interval_list_build( is, result->lefts, result->rights, result->count );
+
+                free( result->lefts );
+                free( result->rights );
+        }
+}
+
+void
+interval_set_defer( interval_set_t* is, size_t capacity )
+{
+        /*
+                Switches the set to deferred mode, queueing up to 'capacity'
+                operations, or back to applying them right away for 0.
+         */
+
+        interval_set_flush( is );
+
+        is->pending = ( interval_op_t* ) realloc( is->pending, ( capacity ? capacity : 1 ) * sizeof( interval_op_t ) );
+        is->pendingCapacity = capacity;
+}
+
+static void
+interval_set_queue( interval_set_t* is, int kind, int newLeft, int newRight )
+{
+        /*
+                Queues an operation in deferred mode. Queued operations whose
+                range the new one covers are dropped, since the new one 
+                decides every value they touched ( an add undone by a remove
+                of the same range leaves just the remove ). The new operation
+                is then merged into the one before it if that is of the same
+                kind and overlaps or touches it.
+         */
+
+        interval_op_t*  last;
+
+        while ( is->pendingCount )
+        {
+                last = &is->pending[is->pendingCount - 1];
+
+                if ( last->left < newLeft || last->right > newRight )
+                {
+                        break;
+                }
+
+                is->pendingCount--;
+        }
+
+        if ( is->pendingCount )
+        {
+                last = &is->pending[is->pendingCount - 1];
+
+                if ( last->kind == kind && last->left <= newRight && newLeft <= last->right )
+                {
+                        last->left = last->left < newLeft ? last->left : newLeft;
+                        last->right = last->right > newRight ? last->right : newRight;
+
+                        return;
+                }
+        }
+
+        if ( is->pendingCount == is->pendingCapacity )
+        {
+                interval_set_flush( is );
+        }
+
+        is->pending[is->pendingCount].kind = kind;
+        is->pending[is->pendingCount].left = newLeft;
+        is->pending[is->pendingCount].right = newRight;
+        is->pendingCount++;
+}
+
+static void
+interval_set_add_now( interval_set_t* is, int newLeft, int newRight )
+{
+#ifdef INTERVAL_STATS
+        uint64_t        start = interval_stats_clock();
+#endif
+
+        is->modifications++;
+
+        if ( is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                interval_array_add( is, &is->array, newLeft, newRight );
+        }
+        else if ( is->backend == INTERVAL_BACKEND_BLOCK )
+        {
+                interval_blocks_update( is, newLeft, newRight, INTERVAL_OP_ADD );
+        }
+        else if ( is->backend == INTERVAL_BACKEND_HYBRID )
+        {
+                interval_chunks_update( is, newLeft, newRight, 1 );
+        }
+        else
+        {
+                interval_list_add( is, newLeft, newRight );
+        }
+
+#ifdef INTERVAL_STATS
+        is->stats.adds++;
+        interval_stats_record( is, 0, start );
+#endif
+}
+
+static int
+interval_set_remove_now( interval_set_t* is, int newLeft, int newRight )
+{
+        /*
+                Returns 0 if the set was empty ( and so left alone ).
+         */
+
+#ifdef INTERVAL_STATS
+        uint64_t        start = interval_stats_clock();
+#endif
+
+        is->modifications++;
+
+        if ( is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                if ( !is->array.count )
+                {
+                        INTERVAL_STAT_HIT( is, INTERVAL_STAT_REMOVE_EMPTY );
+                        return 0;
+                }
+
+                interval_array_remove( is, &is->array, newLeft, newRight );
+        }
+        else if ( is->backend == INTERVAL_BACKEND_BLOCK )
+        {
+                if ( !is->blocks.intervals )
+                {
+                        INTERVAL_STAT_HIT( is, INTERVAL_STAT_REMOVE_EMPTY );
+                        return 0;
+                }
+
+                interval_blocks_update( is, newLeft, newRight, INTERVAL_OP_REMOVE );
+        }
+        else if ( is->backend == INTERVAL_BACKEND_HYBRID )
+        {
+                if ( !is->chunks.count )
+                {
+                        INTERVAL_STAT_HIT( is, INTERVAL_STAT_REMOVE_EMPTY );
+                        return 0;
+                }
+
+                interval_chunks_update( is, newLeft, newRight, 0 );
+        }
+        else
+        {
+                if ( !is->head )
+                {
+                        INTERVAL_STAT_HIT( is, INTERVAL_STAT_REMOVE_EMPTY );
+                        return 0;
+                }
+
+                interval_list_remove( is, newLeft, newRight );
+        }
+
+#ifdef INTERVAL_STATS
+        is->stats.removes++;
+        interval_stats_record( is, 1, start );
+#endif
+
+        return 1;
+}
+
+void
+interval_set_add( interval_set_t* is,
+                int newLeft,
+                int newRight,
+                int should_print )
+{
+        if ( newLeft >= newRight )
+        {
+                return;
+        }
+
+        /*
+                An operation that prints is applied right away ( after the 
+                queue ), since the print would apply it anyway.
+         */
+
+        if ( is->pendingCapacity && !should_print )
+        {
+                interval_set_queue( is, INTERVAL_OP_ADD, newLeft, newRight );
+                return;
+        }
+
+        interval_set_flush( is );
+        interval_set_add_now( is, newLeft, newRight );
+
+        if ( should_print )
+        {
+                interval_set_print( is );
+        }
+}
+
+void
+interval_set_remove( interval_set_t* is,
+                int newLeft,
+                int newRight,
+                int should_print )
+{
+        if ( newLeft >= newRight )
+        {
+                return;
+        }
+
+        if ( is->pendingCapacity && !should_print )
+        {
+                interval_set_queue( is, INTERVAL_OP_REMOVE, newLeft, newRight );
+                return;
+        }
+
+        interval_set_flush( is );
+
+        if ( !interval_set_remove_now( is, newLeft, newRight ) )
+        {
+                return;
+        }
+
+        if ( should_print )
+        {
+                interval_set_print( is );
+        }
+}
+
+int
+interval_set_contains( interval_set_t* is, int value )
+{
+        /*
+                Only the interval starting closest before ( or at ) 'value'
+                can contain it.
+         */
+
+        interval_set_flush( is );
+
+        if ( is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                size_t  i = interval_array_upper_bound( is->array.lefts, is->array.count, value );
+
+                return i > 0 && value < is->array.rights[i - 1];
+        }
+
+        if ( is->backend == INTERVAL_BACKEND_BLOCK )
+        {
+                int     left;
+                int     right;
+
+                return interval_blocks_floor( &is->blocks, value, &left, &right ) && value < right;
+        }
+
+        if ( is->backend == INTERVAL_BACKEND_HYBRID )
+        {
+                return interval_chunks_contains( &is->chunks, value );
+        }
+
+        interval_t*     floor = interval_set_floor( is, value );
+
+        return floor && value < floor->right;
+}
+
+int
+interval_set_overlaps( interval_set_t* is, int newLeft, int newRight )
+{
+        /*
+                [newLeft, newRight) overlaps the set if the last interval 
+                starting before 'newRight' ends after 'newLeft'.
+         */
+
+        if ( newLeft >= newRight )
+        {
+                return 0;
+        }
+
+        interval_set_flush( is );
+
+        if ( is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                size_t  i = interval_array_lower_bound( is->array.lefts, is->array.count, newRight );
+
+                return i > 0 && newLeft < is->array.rights[i - 1];
+        }
+
+        if ( is->backend == INTERVAL_BACKEND_BLOCK )
+        {
+                int     left;
+                int     right;
+
+                return interval_blocks_floor( &is->blocks, newRight - 1, &left, &right ) && newLeft < right;
+        }
+
+        if ( is->backend == INTERVAL_BACKEND_HYBRID )
+        {
+                return interval_chunks_overlaps( &is->chunks, newLeft, newRight );
+        }
+
+        interval_t*     floor = interval_set_floor( is, newRight - 1 );
+
+        return floor && newLeft < floor->right;
+}
+
+static void
+interval_set_prefix( interval_set_t* is, int value, size_t* count, int64_t* length, interval_t** last )
+{
+        /*
+                Sums the nodes starting before 'value' and their lengths 
+                using the subtree totals on the way down the treap, and 
+                returns the last of them in 'last' ( the only one that can 
+                reach past 'value' ).
+         */
+
+        interval_t*     p = is->root;
+
+        *count = 0;
+        *length = 0;
+        *last = NULL;
+
+        while ( p )
+        {
+                if ( p->left < value )
+                {
+                        *count += 1 + ( p->lchild ? p->lchild->size : 0 );
+                        *length += ( int64_t ) p->right - p->left + ( p->lchild ? p->lchild->length : 0 );
+                        *last = p;
+                        p = p->rchild;
+                }
+                else
+                {
+                        p = p->lchild;
+                }
+        }
+}
+
+int64_t
+interval_set_covered( interval_set_t* is, int a, int b )
+{
+        /*
+                Returns how many values of [a, b) are in the set. With the 
+                list backend, this is the covered length before 'b' minus 
+                the covered length before 'a', each taken from the treap in
+                O(log n). The other backends walk the intervals in the range.
+         */
+
+        int64_t         covered = 0;
+
+        if ( a >= b )
+        {
+                return 0;
+        }
+
+        interval_set_flush( is );
+
+        if ( is->backend == INTERVAL_BACKEND_LIST )
+        {
+                size_t          count;
+                int64_t         before[2];
+                interval_t*     last;
+                int             bounds[2] = { a, b };
+
+                for ( int i = 0; i < 2; i++ )
+                {
+                        interval_set_prefix( is, bounds[i], &count, &before[i], &last );
+
+                        if ( last && last->right > bounds[i] )
+                        {
+                                before[i] -= ( int64_t ) last->right - bounds[i];
+                        }
+                }
+
+                return before[1] - before[0];
+        }
+
+        if ( is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                size_t  first = interval_array_upper_bound( is->array.rights, is->array.count, a );
+                size_t  last = interval_array_lower_bound( is->array.lefts, is->array.count, b );
+
+                for ( size_t i = first; i < last; i++ )
+                {
+                        covered += ( int64_t ) ( is->array.rights[i] < b ? is->array.rights[i] : b ) - ( is->array.lefts[i] > a ? is->array.lefts[i] : a );
+                }
+
+                return covered;
+        }
+
+        interval_iter_t         it;
+        int                     left;
+        int                     right;
+
+        interval_iter_begin( &it, is );
+
+        while ( interval_iter_next( &it, &left, &right ) && left < b )
+        {
+                if ( right > a )
+                {
+                        covered += ( int64_t ) ( right < b ? right : b ) - ( left > a ? left : a );
+                }
+        }
+
+        return covered;
+}
+
+size_t
+interval_set_count_range( interval_set_t* is, int a, int b )
+{
+        /*
+                Returns how many intervals overlap [a, b): those starting 
+                before 'b', less those ending at or before 'a'. Every interval
+                starting before 'a' ends at or before it, except possibly the
+                last one.
+         */
+
+        if ( a >= b )
+        {
+                return 0;
+        }
+
+        interval_set_flush( is );
+
+        if ( is->backend == INTERVAL_BACKEND_LIST )
+        {
+                size_t          countA;
+                size_t          countB;
+                int64_t         length;
+                interval_t*     last;
+
+                interval_set_prefix( is, b, &countB, &length, &last );
+                interval_set_prefix( is, a, &countA, &length, &last );
+
+                return countB - countA + ( last && last->right > a );
+        }
+
+        if ( is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                return interval_array_lower_bound( is->array.lefts, is->array.count, b ) 
+                        - interval_array_upper_bound( is->array.rights, is->array.count, a );
+        }
+
+        interval_iter_t         it;
+        int                     left;
+        int                     right;
+        size_t                  count = 0;
+
+        interval_iter_begin( &it, is );
+
+        while ( interval_iter_next( &it, &left, &right ) && left < b )
+        {
+                count += right > a;
+        }
+
+        return count;
+}
+
+int
+interval_set_kth( interval_set_t* is, size_t k, int* left, int* right )
+{
+        /*
+                Finds the k-th interval of the set ( counting from 0 ) and
+                returns 1, or 0 if the set has no more than k intervals. The
+                list backend descends the treap by subtree sizes.
+         */
+
+        interval_set_flush( is );
+
+        if ( is->backend == INTERVAL_BACKEND_LIST )
+        {
+                interval_t*     p = is->root;
+
+                while ( p )
+                {
+                        size_t  before = p->lchild ? p->lchild->size : 0;
+
+                        if ( k < before )
+                        {
+                                p = p->lchild;
+                        }
+                        else if ( k == before )
+                        {
+                                *left = p->left;
+                                *right = p->right;
+
+                                return 1;
+                        }
+                        else
+                        {
+                                k -= before + 1;
+                                p = p->rchild;
+                        }
+                }
+
+                return 0;
+        }
+
+        if ( is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                if ( k >= is->array.count )
+                {
+                        return 0;
+                }
+
+                *left = is->array.lefts[k];
+                *right = is->array.rights[k];
+
+                return 1;
+        }
+
+        interval_iter_t         it;
+
+        interval_iter_begin( &it, is );
+
+        while ( interval_iter_next( &it, left, right ) )
+        {
+                if ( k-- == 0 )
+                {
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+static int
+interval_blocks_ceiling( interval_blocks_t* bs, int value, int* left, int* right )
+{
+        /*
+                Finds the first interval ending after 'value', returning 0 
+                if there is none. Only the block 'value' falls in and the 
+                one after it can hold it.
+         */
+
+        interval_block_cursor_t c;
+        size_t                  i = interval_blocks_find( bs, value );
+
+        for ( ; i < bs->count; i++ )
+        {
+                interval_block_open( &c, &bs->blocks[i] );
+
+                while ( interval_block_read( &c, left, right ) )
+                {
+                        if ( *right > value )
+                        {
+                                return 1;
+                        }
+                }
+        }
+
+        return 0;
+}
+
+static int
+interval_cursor_settle( interval_cursor_t* c, int* left, int* right )
+{
+        /*
+                Loads the interval the cursor is now on from where it is 
+                stored, or marks the cursor as past the end.
+         */
+
+        c->modifications = c->is->modifications;
+
+        if ( c->is->backend == INTERVAL_BACKEND_LIST )
+        {
+                c->valid = c->node != NULL;
+
+                if ( c->valid )
+                {
+                        c->left = c->node->left;
+                        c->right = c->node->right;
+                }
+        }
+        else if ( c->is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                c->valid = c->index < c->is->array.count;
+
+                if ( c->valid )
+                {
+                        c->left = c->is->array.lefts[c->index];
+                        c->right = c->is->array.rights[c->index];
+                }
+        }
+
+        if ( c->valid )
+        {
+                *left = c->left;
+                *right = c->right;
+        }
+
+        return c->valid;
+}
+
+int
+interval_cursor_seek( interval_cursor_t* c, interval_set_t* is, int value, int* left, int* right )
+{
+        /*
+                Puts the cursor on the first interval ending after 'value' 
+                ( the one containing it, or else the next one ) and returns
+                it, in O(log n). Returns 0 if there is no such interval.
+         */
+
+        interval_set_flush( is );
+
+        c->is = is;
+        c->node = NULL;
+        c->index = 0;
+        c->valid = 0;
+
+        if ( is->backend == INTERVAL_BACKEND_LIST )
+        {
+                interval_t*     floor = interval_set_floor( is, value );
+
+                c->node = !floor ? is->head : floor->right > value ? floor : floor->next;
+        }
+        else if ( is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                c->index = interval_array_upper_bound( is->array.rights, is->array.count, value );
+        }
+        else if ( is->backend == INTERVAL_BACKEND_BLOCK )
+        {
+                c->valid = interval_blocks_ceiling( &is->blocks, value, &c->left, &c->right );
+        }
+        else
+        {
+                c->valid = interval_chunks_ceiling( &is->chunks, value, &c->left, &c->right );
+        }
+
+        return interval_cursor_settle( c, left, right );
+}
+
+int
+interval_cursor_next( interval_cursor_t* c, int* left, int* right )
+{
+        /*
+                Moves to the next interval and returns it, or returns 0 ( and
+                leaves the cursor past the end ) if there is none. O(1) with
+                the list and array backends, a search with the others.
+         */
+
+        if ( !c->valid )
+        {
+                return 0;
+        }
+
+        if ( c->modifications != c->is->modifications && ( c->is->backend == INTERVAL_BACKEND_LIST || c->is->backend == INTERVAL_BACKEND_ARRAY ) )
+        {
+                return interval_cursor_seek( c, c->is, c->right, left, right );
+        }
+
+        if ( c->is->backend == INTERVAL_BACKEND_LIST )
+        {
+                c->node = c->node->next;
+        }
+        else if ( c->is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                c->index++;
+        }
+        else if ( c->is->backend == INTERVAL_BACKEND_BLOCK )
+        {
+                c->valid = interval_blocks_ceiling( &c->is->blocks, c->right, &c->left, &c->right );
+        }
+        else
+        {
+                c->valid = interval_chunks_ceiling( &c->is->chunks, c->right, &c->left, &c->right );
+        }
+
+        return interval_cursor_settle( c, left, right );
+}
+
+int
+interval_cursor_prev( interval_cursor_t* c, int* left, int* right )
+{
+        /*
+                Moves to the previous interval and returns it, or returns 0
+                ( and leaves the cursor before the start ) if there is none.
+         */
+
+        if ( !c->valid )
+        {
+                return 0;
+        }
+
+        if ( c->modifications != c->is->modifications && ( c->is->backend == INTERVAL_BACKEND_LIST || c->is->backend == INTERVAL_BACKEND_ARRAY ) )
+        {
+                interval_set_flush( c->is );
+
+                if ( c->is->backend == INTERVAL_BACKEND_LIST )
+                {
+                        c->node = c->left == INT32_MIN ? NULL : interval_set_floor( c->is, c->left - 1 );
+                }
+                else
+                {
+                        size_t  i = c->left == INT32_MIN ? 0 : interval_array_upper_bound( c->is->array.lefts, c->is->array.count, c->left - 1 );
+
+                        c->index = i ? i - 1 : c->is->array.count;
+                }
+        }
+        else if ( c->is->backend == INTERVAL_BACKEND_LIST )
+        {
+                c->node = c->node->prev;
+        }
+        else if ( c->is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                c->index = c->index ? c->index - 1 : c->is->array.count;
+        }
+        else if ( c->left == INT32_MIN )
+        {
+                c->valid = 0;
+        }
+        else if ( c->is->backend == INTERVAL_BACKEND_BLOCK )
+        {
+                c->valid = interval_blocks_floor( &c->is->blocks, c->left - 1, &c->left, &c->right );
+        }
+        else
+        {
+                c->valid = interval_chunks_floor( &c->is->chunks, c->left - 1, &c->left, &c->right );
+        }
+
+        return interval_cursor_settle( c, left, right );
+}
+
+size_t
+interval_set_read_range( interval_set_t* is, int a, int b, int* lefts, int* rights, size_t capacity )
+{
+        /*
+                Copies up to 'capacity' of the intervals overlapping [a, b)
+                into 'lefts' and 'rights', whole ( not clipped to the range )
+                and in order, and returns how many it copied. A full buffer
+                is continued by calling again from the last right value. The
+                array backend copies straight out of its arrays.
+         */
+
+        interval_cursor_t       c;
+        size_t                  n = 0;
+        int                     left;
+        int                     right;
+
+        if ( a >= b || !capacity )
+        {
+                return 0;
+        }
+
+        if ( !interval_cursor_seek( &c, is, a, &left, &right ) )
+        {
+                return 0;
+        }
+
+        if ( is->backend == INTERVAL_BACKEND_ARRAY )
+        {
+                n = interval_array_lower_bound( is->array.lefts, is->array.count, b ) - c.index;
+                n = n < capacity ? n : capacity;
+
+                memcpy( lefts, &is->array.lefts[c.index], n * sizeof( int ) );
+                memcpy( rights, &is->array.rights[c.index], n * sizeof( int ) );
+
+                return n;
+        }
+
+        while ( left < b )
+        {
+                lefts[n] = left;
+                rights[n] = right;
+
+                if ( ++n == capacity || !interval_cursor_next( &c, &left, &right ) )
+                {
+                        break;
+                }
+        }
+
+        return n;
+}
+
+static void
+interval_cursor_follow( interval_cursor_t* c, interval_set_t* is, int value )
+{
+        /*
+                Seeks the cursor to 'value' after a hinted write, searching
+                from the finger with the list backend.
+         */
+
+        int     left;
+        int     right;
+
+        if ( is->backend == INTERVAL_BACKEND_LIST )
+        {
+                interval_t*     floor = interval_set_floor_near( is, is->finger, value );
+
+                c->is = is;
+                c->node = !floor ? is->head : floor->right > value ? floor : floor->next;
+
+                interval_cursor_settle( c, &left, &right );
+        }
+        else
+        {
+                interval_cursor_seek( c, is, value, &left, &right );
+        }
+}
+
+void
+interval_set_add_at( interval_set_t* is, interval_cursor_t* hint, int newLeft, int newRight )
+{
+        /*
+                interval_set_add for callers that know where they write: with
+                the list backend the searches start from the interval 'hint'
+                ( a cursor on this set ) is on, rather than from wherever the
+                last operation was. A hint taken before the set last changed
+                is ignored, as its node may have been freed. The cursor is
+                then moved to the first interval ending after 'newLeft' ( the
+                one the range ended up in ), ready for the next write nearby.
+                Nothing is queued in deferred mode, and nothing is printed.
+         */
+
+        interval_set_flush( is );
+
+        if ( hint->valid && hint->is == is && hint->modifications == is->modifications && is->backend == INTERVAL_BACKEND_LIST )
+        {
+                is->finger = hint->node;
+        }
+
+        if ( newLeft < newRight )
+        {
+                interval_set_add_now( is, newLeft, newRight );
+        }
+
+        interval_cursor_follow( hint, is, newLeft );
+}
+
+void
+interval_set_remove_at( interval_set_t* is, interval_cursor_t* hint, int newLeft, int newRight )
+{
+        /*
+                The hinted interval_set_remove, as interval_set_add_at. The
+                cursor ends up on the first interval after the removed range.
+         */
+
+        interval_set_flush( is );
+
+        if ( hint->valid && hint->is == is && hint->modifications == is->modifications && is->backend == INTERVAL_BACKEND_LIST )
+        {
+                is->finger = hint->node;
+        }
+
+        if ( newLeft < newRight )
+        {
+                interval_set_remove_now( is, newLeft, newRight );
+        }
+
+        interval_cursor_follow( hint, is, newLeft );
+}
+
+static void
+interval_array_contains_batch_scalar( interval_array_t* a, const int* values, size_t n, unsigned char* out )
+{
+        /*
+                Branchless binary search: every step halves the remaining
+                range with a conditional move instead of a branch, so the 
+                search for each value does the same fixed number of steps.
+         */
+
+        for ( size_t k = 0; k < n; k++ )
+        {
+                size_t  base = 0;
+                size_t  len = a->count;
+                int     value = values[k];
+
+                while ( len > 1 )
+                {
+                        size_t  half = len / 2;
+
+                        base = ( a->lefts[base + half] <= value ) ? base + half : base;
+                        len -= half;
+                }
+
+                out[k] = a->lefts[base] <= value && value < a->rights[base];
+        }
+}
+
+#ifdef INTERVAL_HAVE_AVX2
+
+__attribute__(( target( "avx2" ) ))
+static void
+interval_array_contains_batch_avx2( interval_array_t* a, const int* values, size_t n, unsigned char* out )
+{
+        /*
+                The same branchless binary search as the scalar version, run
+                for 8 values at once: each lane keeps its own 'base' index and
+                gathers the left value it compares against, while 'len' is 
+                the same for every lane.
+         */
+
+        size_t          k = 0;
+
+        for ( ; k + 8 <= n; k += 8 )
+        {
+                __m256i         value = _mm256_loadu_si256( ( const __m256i* ) &values[k] );
+                __m256i         base = _mm256_setzero_si256();
+                size_t          len = a->count;
+                __m256i         lefts;
+                __m256i         rights;
+                __m256i         hit;
+                int             mask;
+
+                while ( len > 1 )
+                {
+                        size_t          half = len / 2;
+                        __m256i         probe = _mm256_add_epi32( base, _mm256_set1_epi32( ( int ) half ) );
+                        __m256i         left = _mm256_i32gather_epi32( a->lefts, probe, 4 );
+                        __m256i         greater = _mm256_cmpgt_epi32( left, value );
+
+                        base = _mm256_blendv_epi8( probe, base, greater );
+                        len -= half;
+                }
+
+                lefts = _mm256_i32gather_epi32( a->lefts, base, 4 );
+                rights = _mm256_i32gather_epi32( a->rights, base, 4 );
+
+                hit = _mm256_andnot_si256( _mm256_cmpgt_epi32( lefts, value ),
+                                _mm256_cmpgt_epi32( rights, value ) );
+
+                mask = _mm256_movemask_ps( _mm256_castsi256_ps( hit ) );
+
+                for ( int lane = 0; lane < 8; lane++ )
+                {
+                        out[k + lane] = ( mask >> lane ) & 1;
+                }
+        }
+
+        interval_array_contains_batch_scalar( a, &values[k], n - k, &out[k] );
+}
+
+#endif
+
+void
+interval_set_contains_batch( interval_set_t* is, const int* values, size_t n, unsigned char* out )
+{
+        /*
+                Sets out[k] to whether values[k] is in the set. With the 
+                array backend the lookups run 8 at a time with AVX2 gathers
+                when the CPU supports it ( and the arrays are small enough to
+                be indexed with 32 bit lanes ).
+         */
+
+        interval_set_flush( is );
+
+        if ( is->backend != INTERVAL_BACKEND_ARRAY )
+        {
+                for ( size_t k = 0; k < n; k++ )
+                {
+                        out[k] = interval_set_contains( is, values[k] );
+                }
+
+                return;
+        }
+
+        if ( !is->array.count )
+        {
+                memset( out, 0, n );
+
+                return;
+        }
+
+#ifdef INTERVAL_HAVE_AVX2
+        if ( is->array.count <= INT32_MAX && __builtin_cpu_supports( "avx2" ) )
+        {
+                interval_array_contains_batch_avx2( &is->array, values, n, out );
+
+                return;
+        }
+#endif
+
+        interval_array_contains_batch_scalar( &is->array, values, n, out );
+}
+
+typedef struct
+{
+        int             value;
+        size_t          op;
+} interval_event_t;
+
+static int
+interval_event_compare( const void* a, const void* b )
+{
+        const interval_event_t*         x = ( const interval_event_t* ) a;
+        const interval_event_t*         y = ( const interval_event_t* ) b;
+
+        if ( x->value != y->value )
+        {
+                return x->value < y->value ? -1 : 1;
+        }
+
+        return 0;
+}
+
+static void
+interval_batch_normalize( const interval_op_t* ops,
+                size_t n,
+                interval_array_t* adds,
+                interval_array_t* removes )
+{
+        /*
+                Reduces a batch to its net effect: every point covered by 
+                some op ends up in the state given by the LAST op covering 
+                it. Sweeping the sorted endpoints while keeping a max-heap of
+                the indices of the ops that are open at the current point
+                tells us which op that is for each elementary segment, and
+                the segments are then coalesced into disjoint sorted runs of 
+                adds and removes.
+         */
+
+        interval_event_t*       events = ( interval_event_t* ) malloc( ( 2 * n + 1 ) * sizeof( interval_event_t ) );
+        size_t*                 heap = ( size_t* ) malloc( ( n + 1 ) * sizeof( size_t ) );
+        char*                   closed = ( char* ) calloc( n + 1, 1 );
+        size_t                  eventCount = 0;
+        size_t                  heapSize = 0;
+        size_t                  i = 0;
+
+        for ( size_t k = 0; k < n; k++ )
+        {
+                if ( ops[k].left < ops[k].right )
+                {
+                        events[eventCount].value = ops[k].left;
+                        events[eventCount++].op = k;
+                        events[eventCount].value = ops[k].right;
+                        events[eventCount++].op = k;
+                }
+        }
+
+        qsort( events, eventCount, sizeof( interval_event_t ), interval_event_compare );
+
+        while ( i < eventCount )
+        {
+                int     value = events[i].value;
+
+                /*
+                        An op's first event opens it, its second closes it.
+                        Ops with the same endpoint on both sides never get 
+                        here, so seeing an op again always means it closes.
+                 */
+
+                for ( ; i < eventCount && events[i].value == value; i++ )
+                {
+                        size_t  op = events[i].op;
+
+                        if ( ops[op].left == value )
+                        {
+                                size_t  child = heapSize++;
+
+                                while ( child && heap[( child - 1 ) / 2] < op )
+                                {
+                                        heap[child] = heap[( child - 1 ) / 2];
+                                        child = ( child - 1 ) / 2;
+                                }
+
+                                heap[child] = op;
+                        }
+                        else
+                        {
+                                closed[op] = 1;
+                        }
+                }
+
+                while ( heapSize && closed[heap[0]] )
+                {
+                        size_t  last = heap[--heapSize];
+                        size_t  parent = 0;
+
+                        while ( 2 * parent + 1 < heapSize )
+                        {
+                                size_t  child = 2 * parent + 1;
+
+                                if ( child + 1 < heapSize && heap[child + 1] > heap[child] )
+                                {
+                                        child++;
+                                }
+
+                                if ( heap[child] <= last )
+                                {
+                                        break;
+                                }
+
+                                heap[parent] = heap[child];
+                                parent = child;
+                        }
+
+                        heap[parent] = last;
+                }
+
+                if ( heapSize && i < eventCount )
+                {
+                        if ( ops[heap[0]].kind == INTERVAL_OP_ADD )
+                        {
+                                interval_array_push( adds, value, events[i].value );
+                        }
+                        else
+                        {
+                                interval_array_push( removes, value, events[i].value );
+                        }
+                }
+        }
+
+        free( closed );
+        free( heap );
+        free( events );
+}
+
+void
+interval_set_apply_batch( interval_set_t* is, const interval_op_t* ops, size_t n )
+{
+        /*
+                Applies a batch of adds and removes with the same result as
+                applying them one at a time in order, but in one sweep: the
+                batch is normalized into disjoint runs to add and to remove,
+                and the set is rebuilt as ( set - removes ) + adds by walking
+                the set and both runs side by side.
+         */
+
+        interval_array_t        adds = { 0 };
+        interval_array_t        removes = { 0 };
+        interval_array_t        result = { 0 };
+        interval_iter_t         it;
+        size_t                  a = 0;
+        size_t                  r = 0;
+        int                     left;
+        int                     right;
+        int                     haveCurrent = 0;
+
+        interval_batch_normalize( ops, n, &adds, &removes );
+        interval_iter_begin( &it, is );
+
+        while ( 1 )
+        {
+                /*
+                        Cut the next piece out of the current interval of the
+                        set, skipping over the removed runs that overlap it.
+                 */
+
+                int     pieceLeft = 0;
+                int     pieceRight = 0;
+                int     havePiece = 0;
+
+                while ( !havePiece )
+                {
+                        if ( !haveCurrent )
+                        {
+                                if ( !interval_iter_next( &it, &left, &right ) )
+                                {
+                                        break;
+                                }
+
+                                haveCurrent = 1;
+                        }
+
+                        while ( r < removes.count && removes.rights[r] <= left )
+                        {
+                                r++;
+                        }
+
+                        if ( r == removes.count || removes.lefts[r] >= right )
+                        {
+                                pieceLeft = left;
+                                pieceRight = right;
+                                havePiece = 1;
+                                haveCurrent = 0;
+                        }
+                        else
+                        {
+                                if ( removes.lefts[r] > left )
+                                {
+                                        pieceLeft = left;
+                                        pieceRight = removes.lefts[r];
+                                        havePiece = 1;
+                                }
+
+                                left = removes.rights[r];
+
+                                if ( left >= right )
+                                {
+                                        haveCurrent = 0;
+                                }
+                        }
+                }
+
+                /*
+                        Emit the added runs that start before the piece, then
+                        the piece itself.
+                 */
+
+                while ( a < adds.count && ( !havePiece || adds.lefts[a] <= pieceLeft ) )
+                {
+                        interval_array_push( &result, adds.lefts[a], adds.rights[a] );
+                        a++;
+                }
+
+                if ( !havePiece )
+                {
+                        break;
+                }
+
+                interval_array_push( &result, pieceLeft, pieceRight );
+        }
+
+        interval_set_assign( is, &result );
+
+        free( adds.lefts );
+        free( adds.rights );
+        free( removes.lefts );
+        free( removes.rights );
+}
+
+void
+interval_set_flush( interval_set_t* is )
+{
+        /*
+                Reduces the queued operations to their net effect ( disjoint
+                runs to remove and to add, as for a batch ) and applies the
+                runs in sorted order. Each run is applied on its own rather
+                than rebuilding the set, since the queue is small next to a
+                large set.
+         */
+
+        interval_array_t        adds = { 0 };
+        interval_array_t        removes = { 0 };
+        size_t                  n = is->pendingCount;
+
+        if ( !n )
+        {
+                return;
+        }
+
+        is->pendingCount = 0;
+
+        interval_batch_normalize( is->pending, n, &adds, &removes );
+
+        for ( size_t i = 0; i < removes.count; i++ )
+        {
+                interval_set_remove_now( is, removes.lefts[i], removes.rights[i] );
+        }
+
+        for ( size_t i = 0; i < adds.count; i++ )
+        {
+                interval_set_add_now( is, adds.lefts[i], adds.rights[i] );
+        }
+
+        free( adds.lefts );
+        free( adds.rights );
+        free( removes.lefts );
+        free( removes.rights );
+}
+
+static int
+interval_thread_count( size_t count )
+{
+        /*
+                How many threads to split 'count' items of work across: one
+                per online core, as long as each gets a worthwhile share.
+         */
+
+#ifdef INTERVAL_THREADS
+        long    cores = INTERVAL_THREADS;
+#else
+        long    cores = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+        int     n = 1;
+
+        while ( n < cores && n < INTERVAL_MAX_THREADS && count / ( n + 1 ) >= INTERVAL_MIN_PER_THREAD )
+        {
+                n++;
+        }
+
+        return n;
+}
+
+/*
+        Shared state of a parallel LSD radix sort. Each thread owns a 
+        contiguous chunk of the input; for every pass it counts the digits
+        in its chunk, thread 0 turns all of the counts into scatter offsets,
+        and then every thread scatters its chunk to those offsets.
+ */
+
+typedef struct
+{
+        uint64_t*               keys;
+        uint64_t*               scratch;
+        size_t                  count;
+        int                     threads;
+        int                     skip;
+        size_t                  offsets[INTERVAL_MAX_THREADS][INTERVAL_RADIX_BUCKETS];
+        pthread_barrier_t       barrier;
+} interval_radix_t;
+
+typedef struct
+{
+        interval_radix_t*       sort;
+        int                     id;
+} interval_radix_worker_t;
+
+static void*
+interval_radix_worker( void* arg )
+{
+        interval_radix_worker_t*        worker = ( interval_radix_worker_t* ) arg;
+        interval_radix_t*               sort = worker->sort;
+        int                             id = worker->id;
+        size_t                          begin = sort->count * id / sort->threads;
+        size_t                          end = sort->count * ( id + 1 ) / sort->threads;
+        uint64_t*                       from = sort->keys;
+        uint64_t*                       to = sort->scratch;
+        uint64_t*                       swap;
+
+        /*
+                Only the upper 32 bits ( the biased 'left' value ) are sorted
+                on, from the least significant digit up.
+         */
+
+        for ( int shift = 32; shift < 64; shift += INTERVAL_RADIX_BITS )
+        {
+                size_t*         counts = sort->offsets[id];
+
+                memset( counts, 0, sizeof( sort->offsets[id] ) );
+
+                for ( size_t i = begin; i < end; i++ )
+                {
+                        counts[( from[i] >> shift ) & ( INTERVAL_RADIX_BUCKETS - 1 )]++;
+                }
+
+                pthread_barrier_wait( &sort->barrier );
+
+                if ( id == 0 )
+                {
+                        size_t  total = 0;
+
+                        sort->skip = 0;
+
+                        for ( int digit = 0; digit < INTERVAL_RADIX_BUCKETS; digit++ )
+                        {
+                                size_t  bucket = 0;
+
+                                for ( int t = 0; t < sort->threads; t++ )
+                                {
+                                        size_t  n = sort->offsets[t][digit];
+
+                                        sort->offsets[t][digit] = total;
+                                        total += n;
+                                        bucket += n;
+                                }
+
+                                if ( bucket == sort->count )
+                                {
+                                        /*
+                                                Every key has the same digit, so 
+                                                this pass would not move anything.
+                                         */
+
+                                        sort->skip = 1;
+                                }
+                        }
+                }
+
+                pthread_barrier_wait( &sort->barrier );
+
+                if ( !sort->skip )
+                {
+                        for ( size_t i = begin; i < end; i++ )
+                        {
+                                to[counts[( from[i] >> shift ) & ( INTERVAL_RADIX_BUCKETS - 1 )]++] = from[i];
+                        }
+
+                        swap = from;
+                        from = to;
+                        to = swap;
+                }
+
+                pthread_barrier_wait( &sort->barrier );
+        }
+
+        if ( id == 0 && from != sort->keys )
+        {
+                memcpy( sort->keys, from, sort->count * sizeof( uint64_t ) );
+        }
+
+        return NULL;
+}
+
+static void
+interval_radix_sort( uint64_t* keys, size_t count )
+{
+        interval_radix_t*               sort = ( interval_radix_t* ) malloc( sizeof( interval_radix_t ) );
+        interval_radix_worker_t         workers[INTERVAL_MAX_THREADS];
+        pthread_t                       threads[INTERVAL_MAX_THREADS];
+        int                             n = interval_thread_count( count );
+
+        sort->keys = keys;
+        sort->scratch = ( uint64_t* ) malloc( ( count ? count : 1 ) * sizeof( uint64_t ) );
+        sort->count = count;
+        sort->threads = n;
+
+        pthread_barrier_init( &sort->barrier, NULL, n );
+
+        for ( int t = 0; t < n; t++ )
+        {
+                workers[t].sort = sort;
+                workers[t].id = t;
+        }
+
+        for ( int t = 1; t < n; t++ )
+        {
+                pthread_create( &threads[t], NULL, interval_radix_worker, &workers[t] );
+        }
+
+        interval_radix_worker( &workers[0] );
+
+        for ( int t = 1; t < n; t++ )
+        {
+                pthread_join( threads[t], NULL );
+        }
+
+        pthread_barrier_destroy( &sort->barrier );
+
+        free( sort->scratch );
+        free( sort );
+}
+
+interval_set_t*
+interval_set_from_array( int backend, const int* lefts, const int* rights, size_t count )
+{
+        /*
+                Builds a set from intervals in any order, overlapping or not.
+                Each interval is packed into one 64 bit key ( 'left' with its
+                sign bit flipped above 'right' ) so that a radix sort on the 
+                upper half orders them by 'left', and one pass over the sorted
+                keys then coalesces overlapping or touching intervals.
+         */
+
+        interval_set_t*         is = interval_set_create( backend );
+        interval_array_t        result = { 0 };
+        uint64_t*               keys = ( uint64_t* ) malloc( ( count ? count : 1 ) * sizeof( uint64_t ) );
+        size_t                  n = 0;
+
+        for ( size_t i = 0; i < count; i++ )
+        {
+                if ( lefts[i] < rights[i] )
+                {
+                        keys[n++] = ( ( uint64_t ) ( ( uint32_t ) lefts[i] ^ 0x80000000u ) << 32 ) | ( uint32_t ) rights[i];
+                }
+        }
+
+        interval_radix_sort( keys, n );
+
+        for ( size_t i = 0; i < n; i++ )
+        {
+                interval_array_push( &result,
+                                ( int ) ( ( uint32_t ) ( keys[i] >> 32 ) ^ 0x80000000u ),
+                                ( int ) ( uint32_t ) keys[i] );
+        }
+
+        free( keys );
+
+        interval_set_assign( is, &result );
+
+        return is;
+}
+
+typedef struct
+{
+        const interval_array_t*         first;
+        const interval_array_t*         second;
+        int                             table;
+        int                             lo;
+        int                             hi;
+        interval_array_t                result;
+} interval_combine_t;
+
+static void*
+interval_combine_range( void* arg )
+{
+        /*
+                Sweeps the boundaries of both sets inside [lo, hi), keeping
+                track of whether the current point is in each of them, and
+                emits every stretch for which the truth table holds.
+         */
+
+        interval_combine_t*             c = ( interval_combine_t* ) arg;
+        const interval_array_t*         a = c->first;
+        const interval_array_t*         b = c->second;
+        size_t                          i = interval_array_upper_bound( a->rights, a->count, c->lo );
+        size_t                          j = interval_array_upper_bound( b->rights, b->count, c->lo );
+        size_t                          iEnd = interval_array_lower_bound( a->lefts, a->count, c->hi );
+        size_t                          jEnd = interval_array_lower_bound( b->lefts, b->count, c->hi );
+        int                             inA = i < iEnd && a->lefts[i] <= c->lo;
+        int                             inB = j < jEnd && b->lefts[j] <= c->lo;
+        int                             pos = c->lo;
+
+        while ( pos < c->hi )
+        {
+                int     nextA = c->hi;
+                int     nextB = c->hi;
+                int     next;
+
+                if ( i < iEnd )
+                {
+                        nextA = inA ? a->rights[i] : a->lefts[i];
+                }
+
+                if ( j < jEnd )
+                {
+                        nextB = inB ? b->rights[j] : b->lefts[j];
+                }
+
+                next = nextA < nextB ? nextA : nextB;
+
+                if ( next > c->hi )
+                {
+                        next = c->hi;
+                }
+
+                if ( ( c->table >> ( inA * 2 + inB ) ) & 1 )
+                {
+                        interval_array_push( &c->result, pos, next );
+                }
+
+                if ( i < iEnd && nextA == next )
+                {
+                        i += inA;
+                        inA = !inA;
+                }
+
+                if ( j < jEnd && nextB == next )
+                {
+                        j += inB;
+                        inB = !inB;
+                }
+
+                pos = next;
+        }
+
+        return NULL;
+}
+
+static interval_set_t*
+interval_set_combine( int backend,
+                const interval_array_t* a,
+                const interval_array_t* b,
+                int table,
+                int lo,
+                int hi )
+{
+        /*
+                Large inputs are cut into key ranges at evenly spaced left 
+                values of the bigger input, each range is combined on its own
+                thread, and the pieces are concatenated ( re-merging results 
+                that touch across a cut ).
+         */
+
+        interval_combine_t      parts[INTERVAL_MAX_THREADS];
+        pthread_t               threads[INTERVAL_MAX_THREADS];
+        const interval_array_t* bigger = a->count > b->count ? a : b;
+        int                     n = interval_thread_count( a->count + b->count );
+        interval_array_t        result = { 0 };
+        interval_set_t*         is = interval_set_create( backend );
+
+        if ( ( size_t ) n > bigger->count )
+        {
+                n = 1;
+        }
+
+        for ( int t = 0; t < n; t++ )
+        {
+                parts[t].first = a;
+                parts[t].second = b;
+                parts[t].table = table;
+                parts[t].lo = t ? bigger->lefts[bigger->count * t / n] : lo;
+                parts[t].hi = hi;
+                parts[t].result = ( interval_array_t ) { 0 };
+
+                if ( parts[t].lo < lo )
+                {
+                        parts[t].lo = lo;
+                }
+
+                if ( parts[t].lo > hi )
+                {
+                        parts[t].lo = hi;
+                }
+
+                if ( t )
+                {
+                        parts[t - 1].hi = parts[t].lo;
+                }
+        }
+
+        for ( int t = 1; t < n; t++ )
+        {
+                pthread_create( &threads[t], NULL, interval_combine_range, &parts[t] );
+        }
+
+        interval_combine_range( &parts[0] );
+
+        for ( int t = 1; t < n; t++ )
+        {
+                pthread_join( threads[t], NULL );
+        }
+
+        if ( n == 1 )
+        {
+                result = parts[0].result;
+        }
+
+        for ( int t = 0; n > 1 && t < n; t++ )
+        {
+                for ( size_t k = 0; k < parts[t].result.count; k++ )
+                {
+                        interval_array_push( &result, parts[t].result.lefts[k], parts[t].result.rights[k] );
+                }
+
+                free( parts[t].result.lefts );
+                free( parts[t].result.rights );
+        }
+
+        interval_set_assign( is, &result );
+
+        return is;
+}
+
+static interval_set_t*
+interval_set_combine_sets( interval_set_t* first, interval_set_t* second, int table )
+{
+        int                     ownedA;
+        int                     ownedB;
+        interval_array_t        a = interval_set_flatten( first, &ownedA );
+        interval_array_t        b = interval_set_flatten( second, &ownedB );
+        interval_set_t*         result = interval_set_combine( first->backend, &a, &b, table, INT32_MIN, INT32_MAX );
+
+        if ( ownedA )
+        {
+                free( a.lefts );
+                free( a.rights );
+        }
+
+        if ( ownedB )
+        {
+                free( b.lefts );
+                free( b.rights );
+        }
+
+        return result;
+}
+
+interval_set_t*
+interval_set_union( interval_set_t* first, interval_set_t* second )
+{
+        return interval_set_combine_sets( first, second, INTERVAL_COMBINE_UNION );
+}
+
+interval_set_t*
+interval_set_intersect( interval_set_t* first, interval_set_t* second )
+{
+        return interval_set_combine_sets( first, second, INTERVAL_COMBINE_INTERSECT );
+}
+
+interval_set_t*
+interval_set_difference( interval_set_t* first, interval_set_t* second )
+{
+        return interval_set_combine_sets( first, second, INTERVAL_COMBINE_DIFFERENCE );
+}
+
+interval_set_t*
+interval_set_complement( interval_set_t* is, int lo, int hi )
+{
+        /*
+                The complement within [lo, hi) is everything in [lo, hi) 
+                that is not in the set.
+         */
+
+        int                     owned;
+        interval_array_t        a = interval_set_flatten( is, &owned );
+        interval_array_t        whole = { 0 };
+        interval_set_t*         result;
+
+        if ( lo < hi )
+        {
+                interval_array_push( &whole, lo, hi );
+        }
+
+        result = interval_set_combine( is->backend, &a, &whole, INTERVAL_COMBINE_COMPLEMENT, INT32_MIN, INT32_MAX );
+
+        if ( owned )
+        {
+                free( a.lefts );
+                free( a.rights );
+        }
+
+        free( whole.lefts );
+        free( whole.rights );
+
+        return result;
+}
+
+static void
+interval_replay_binary( interval_set_t* is, const interval_op_t* ops, size_t n, int should_print )
+{
+        for ( size_t i = 0; i < n; i++ )
+        {
+                if ( ops[i].kind == INTERVAL_OP_ADD )
+                {
+                        interval_set_add( is, ops[i].left, ops[i].right, should_print );
+                }
+                else if ( ops[i].kind == INTERVAL_OP_REMOVE )
+                {
+                        interval_set_remove( is, ops[i].left, ops[i].right, should_print );
+                }
+        }
+}
+
+typedef struct
+{
+        const interval_op_t*            ops;
+        const size_t*                   bucket;
+        size_t                          n;
+        const interval_array_t*         initial;
+        int                             lo;
+        int                             hi;
+        interval_array_t                result;
+} interval_replay_part_t;
+
+static void*
+interval_replay_range( void* arg )
+{
+        /*
+                Replays the operations of the range's bucket ( those that 
+                touch it, in order ) clipped to [lo, hi), on a private list 
+                set holding the part of the initial set in the range. Whether
+                a value ends up in the set only depends on the operations 
+                that cover it, so each range comes out as it would from a 
+                sequential replay.
+         */
+
+        interval_replay_part_t*         part = ( interval_replay_part_t* ) arg;
+        const interval_array_t*         a = part->initial;
+        interval_set_t*                 is = interval_set_create( INTERVAL_BACKEND_LIST );
+        interval_array_t                initial = { 0 };
+        size_t                          end = interval_array_lower_bound( a->lefts, a->count, part->hi );
+        int                             owned;
+
+        for ( size_t i = interval_array_upper_bound( a->rights, a->count, part->lo ); i < end; i++ )
+        {
+                interval_array_push( &initial,
+                                a->lefts[i] > part->lo ? a->lefts[i] : part->lo,
+                                a->rights[i] < part->hi ? a->rights[i] : part->hi );
+        }
+
+        interval_set_assign( is, &initial );
+
+        for ( size_t k = 0; k < part->n; k++ )
+        {
+                const interval_op_t*    op = &part->ops[part->bucket[k]];
+                int                     left = op->left > part->lo ? op->left : part->lo;
+                int                     right = op->right < part->hi ? op->right : part->hi;
+
+                if ( left >= right )
+                {
+                        continue;
+                }
+
+                if ( op->kind == INTERVAL_OP_ADD )
+                {
+                        interval_set_add( is, left, right, SHOULD_NOT_PRINT );
+                }
+                else
+                {
+                        interval_set_remove( is, left, right, SHOULD_NOT_PRINT );
+                }
+        }
+
+        part->result = interval_set_flatten( is, &owned );
+        interval_set_free( is );
+
+        return NULL;
+}
+
+static int
+interval_int_compare( const void* a, const void* b )
+{
+        int     x = *( const int* ) a;
+        int     y = *( const int* ) b;
+
+        return ( x > y ) - ( x < y );
+}
+
+static int
+interval_replay_route( const interval_replay_part_t* parts, int threadCount, const interval_op_t* op, int* last )
+{
+        /*
+                Finds the ranges [first, last) that an operation touches, 
+                with a binary search for the first one ending after its left
+                value. Returns 'first'; empty operations touch none.
+         */
+
+        int     lo = 0;
+        int     hi = threadCount;
+
+        if ( ( op->kind != INTERVAL_OP_ADD && op->kind != INTERVAL_OP_REMOVE ) || op->left >= op->right )
+        {
+                *last = 0;
+                return 0;
+        }
+
+        while ( lo < hi )
+        {
+                int     mid = lo + ( hi - lo ) / 2;
+
+                if ( parts[mid].hi <= op->left )
+                {
+                        lo = mid + 1;
+                }
+                else
+                {
+                        hi = mid;
+                }
+        }
+
+        *last = lo;
+
+        while ( *last < threadCount && parts[*last].lo < op->right )
+        {
+                ( *last )++;
+        }
+
+        return lo;
+}
+
+void
+interval_set_replay_ops( interval_set_t* is, const interval_op_t* ops, size_t n )
+{
+        /*
+                Applies a long run of operations with the same result as 
+                applying them one at a time, using all cores. The key space
+                is cut into one range per thread at quantiles of a sample of 
+                the operations' left values. One pass sorts the operations' 
+                indexes into a bucket per range ( counted first, then filled 
+                in, so they share one array ), and every thread replays, in 
+                order, only its bucket clipped to its range. The ranges are 
+                then concatenated ( re-merging intervals that touch across a cut )
+                and assigned to the set. The change feed therefore reports 
+                the net change of the whole run.
+         */
+
+        interval_replay_part_t  parts[INTERVAL_MAX_THREADS];
+        pthread_t               threads[INTERVAL_MAX_THREADS];
+        int                     sample[1024];
+        int                     samples = 0;
+        int                     threadCount = interval_thread_count( n );
+        interval_array_t        result = { 0 };
+        interval_array_t        initial;
+        size_t*                 buckets;
+        size_t*                 fill[INTERVAL_MAX_THREADS];
+        size_t                  total = 0;
+        int                     owned;
+
+        if ( threadCount == 1 )
+        {
+                interval_replay_binary( is, ops, n, SHOULD_NOT_PRINT );
+                return;
+        }
+
+        for ( size_t i = 0; i < n && samples < 1024; i += n / 1024 + 1 )
+        {
+                sample[samples++] = ops[i].left;
+        }
+
+        qsort( sample, samples, sizeof( int ), interval_int_compare );
+
+        initial = interval_set_flatten( is, &owned );
+
+        for ( int t = 0; t < threadCount; t++ )
+        {
+                parts[t].ops = ops;
+                parts[t].n = 0;
+                parts[t].initial = &initial;
+                parts[t].lo = t ? sample[( size_t ) samples * t / threadCount] : INT32_MIN;
+                parts[t].hi = INT32_MAX;
+                parts[t].result = ( interval_array_t ) { 0 };
+
+                if ( t )
+                {
+                        parts[t - 1].hi = parts[t].lo;
+                }
+        }
+
+        for ( size_t i = 0; i < n; i++ )
+        {
+                int     last;
+
+                for ( int t = interval_replay_route( parts, threadCount, &ops[i], &last ); t < last; t++ )
+                {
+                        parts[t].n++;
+                }
+        }
+
+        for ( int t = 0; t < threadCount; t++ )
+        {
+                total += parts[t].n;
+        }
+
+        buckets = ( size_t* ) malloc( ( total + 1 ) * sizeof( size_t ) );
+        total = 0;
+
+        for ( int t = 0; t < threadCount; t++ )
+        {
+                fill[t] = buckets + total;
+                parts[t].bucket = fill[t];
+                total += parts[t].n;
+        }
+
+        for ( size_t i = 0; i < n; i++ )
+        {
+                int     last;
+
+                for ( int t = interval_replay_route( parts, threadCount, &ops[i], &last ); t < last; t++ )
+                {
+                        *fill[t]++ = i;
+                }
+        }
+
+        for ( int t = 1; t < threadCount; t++ )
+        {
+                pthread_create( &threads[t], NULL, interval_replay_range, &parts[t] );
+        }
+
+        interval_replay_range( &parts[0] );
+
+        for ( int t = 1; t < threadCount; t++ )
+        {
+                pthread_join( threads[t], NULL );
+        }
+
+        for ( int t = 0; t < threadCount; t++ )
+        {
+                for ( size_t k = 0; k < parts[t].result.count; k++ )
+                {
+                        interval_array_push( &result, parts[t].result.lefts[k], parts[t].result.rights[k] );
+                }
+
+                free( parts[t].result.lefts );
+                free( parts[t].result.rights );
+        }
+
+        if ( owned )
+        {
+                free( initial.lefts );
+                free( initial.rights );
+        }
+
+        free( buckets );
+        interval_set_assign( is, &result );
+}
+
+interval_set_concurrent_t*
+interval_set_concurrent_create( void )
+{
+        interval_set_concurrent_t*      ic = ( interval_set_concurrent_t* ) calloc( 1, sizeof( interval_set_concurrent_t ) );
+
+        atomic_init( &ic->root, NULL );
+        atomic_init( &ic->epoch, 1 );
+        pthread_mutex_init( &ic->writer, NULL );
+        ic->seed = 2463534242u;
+
+        return ic;
+}
+
+static void
+interval_pnode_free_tree( interval_pnode_t* node )
+{
+        if ( node )
+        {
+                interval_pnode_free_tree( node->lchild );
+                interval_pnode_free_tree( node->rchild );
+                free( node );
+        }
+}
+
+void
+interval_set_concurrent_free( interval_set_concurrent_t* ic )
+{
+        /*
+                Must only be called once no reader or writer uses the set.
+         */
+
+        for ( size_t i = ic->retiredHead; i < ic->retiredCount; i++ )
+        {
+                free( ic->retired[i].node );
+        }
+
+        interval_pnode_free_tree( atomic_load( &ic->root ) );
+        pthread_mutex_destroy( &ic->writer );
+        free( ic->retired );
+        free( ic );
+}
+
+int
+interval_set_concurrent_register( interval_set_concurrent_t* ic )
+{
+        /*
+                Claims a reader slot for the calling thread, returning its 
+                index ( or -1 if all INTERVAL_MAX_READERS slots are taken ).
+         */
+
+        for ( int i = 0; i < INTERVAL_MAX_READERS; i++ )
+        {
+                int     expected = 0;
+
+                if ( atomic_compare_exchange_strong( &ic->readers[i].used, &expected, 1 ) )
+                {
+                        return i;
+                }
+        }
+
+        return -1;
+}
+
+void
+interval_set_concurrent_unregister( interval_set_concurrent_t* ic, int reader )
+{
+        atomic_store( &ic->readers[reader].epoch, 0 );
+        atomic_store( &ic->readers[reader].used, 0 );
+}
+
+interval_snapshot_t
+interval_set_concurrent_read_begin( interval_set_concurrent_t* ic, int reader )
+{
+        /*
+                Announcing the epoch before loading the root guarantees that
+                a writer either sees the announcement ( and keeps the nodes 
+                of this snapshot ) or published its root before we load it.
+         */
+
+        interval_snapshot_t     snapshot;
+
+        atomic_store( &ic->readers[reader].epoch, atomic_load( &ic->epoch ) );
+        snapshot.root = atomic_load( &ic->root );
+
+        return snapshot;
+}
+
+void
+interval_set_concurrent_read_end( interval_set_concurrent_t* ic, int reader )
+{
+        atomic_store_explicit( &ic->readers[reader].epoch, 0, memory_order_release );
+}
+
+static void
+interval_set_concurrent_retire( interval_set_concurrent_t* ic, interval_pnode_t* node )
+{
+        /*
+                Nodes created by the write in progress were never visible to
+                a reader and can go right away, all others wait for the 
+                readers. They were last reachable in the current epoch, 
+                which only the writer ( holding the mutex ) moves forward.
+         */
+
+        if ( node->version == ic->version )
+        {
+                free( node );
+                return;
+        }
+
+        if ( ic->retiredCount == ic->retiredCapacity )
+        {
+                if ( ic->retiredHead )
+                {
+                        memmove( ic->retired, &ic->retired[ic->retiredHead], ( ic->retiredCount - ic->retiredHead ) * sizeof( interval_retired_t ) );
+                        ic->retiredCount -= ic->retiredHead;
+                        ic->retiredHead = 0;
+                }
+
+                if ( ic->retiredCount == ic->retiredCapacity )
+                {
+                        ic->retiredCapacity = ic->retiredCapacity ? ic->retiredCapacity * 2 : 64;
+                        ic->retired = ( interval_retired_t* ) realloc( ic->retired, ic->retiredCapacity * sizeof( interval_retired_t ) );
+                }
+        }
+
+        ic->retired[ic->retiredCount].node = node;
+        ic->retired[ic->retiredCount].epoch = atomic_load_explicit( &ic->epoch, memory_order_relaxed );
+        ic->retiredCount++;
+}
+
+static interval_pnode_t*
+interval_pnode_own( interval_set_concurrent_t* ic, interval_pnode_t* node )
+{
+        /*
+                Returns a node that the current write may modify: the node 
+                itself if this write created it, or else a copy of it ( the 
+                original is retired ).
+         */
+
+        interval_pnode_t*       copy;
+
+        if ( node->version == ic->version )
+        {
+                return node;
+        }
+
+        copy = ( interval_pnode_t* ) malloc( sizeof( interval_pnode_t ) );
+        *copy = *node;
+        copy->version = ic->version;
+
+        interval_set_concurrent_retire( ic, node );
+
+        return copy;
+}
+
+static void
+interval_pnode_split( interval_set_concurrent_t* ic,
+                interval_pnode_t* node,
+                int key,
+                interval_pnode_t** less,
+                interval_pnode_t** rest )
+{
+        /*
+                Splits a tree into the nodes whose 'left' is less than 'key'
+                and the rest, copying only the nodes on the search path.
+         */
+
+        if ( !node )
+        {
+                *less = NULL;
+                *rest = NULL;
+                return;
+        }
+
+        node = interval_pnode_own( ic, node );
+
+        if ( node->left < key )
+        {
+                interval_pnode_split( ic, node->rchild, key, &node->rchild, rest );
+                *less = node;
+        }
+        else
+        {
+                interval_pnode_split( ic, node->lchild, key, less, &node->lchild );
+                *rest = node;
+        }
+}
+
+static interval_pnode_t*
+interval_pnode_merge( interval_set_concurrent_t* ic, interval_pnode_t* less, interval_pnode_t* rest )
+{
+        /*
+                Joins two trees where every key of 'less' is smaller than 
+                every key of 'rest'.
+         */
+
+        interval_pnode_t*       node;
+
+        if ( !less || !rest )
+        {
+                return less ? less : rest;
+        }
+
+        if ( less->priority > rest->priority )
+        {
+                node = interval_pnode_own( ic, less );
+                node->rchild = interval_pnode_merge( ic, node->rchild, rest );
+        }
+        else
+        {
+                node = interval_pnode_own( ic, rest );
+                node->lchild = interval_pnode_merge( ic, less, node->lchild );
+        }
+
+        return node;
+}
+
+static void
+interval_pnode_drop( interval_set_concurrent_t* ic, interval_pnode_t* node )
+{
+        if ( node )
+        {
+                interval_pnode_drop( ic, node->lchild );
+                interval_pnode_drop( ic, node->rchild );
+                interval_set_concurrent_retire( ic, node );
+        }
+}
+
+static interval_pnode_t*
+interval_pnode_create( interval_set_concurrent_t* ic, int left, int right )
+{
+        interval_pnode_t*       node = ( interval_pnode_t* ) calloc( 1, sizeof( interval_pnode_t ) );
+
+        ic->seed ^= ic->seed << 13;
+        ic->seed ^= ic->seed >> 17;
+        ic->seed ^= ic->seed << 5;
+
+        node->left = left;
+        node->right = right;
+        node->priority = ic->seed;
+        node->version = ic->version;
+
+        return node;
+}
+
+static const interval_pnode_t*
+interval_pnode_floor( const interval_pnode_t* node, int value )
+{
+        const interval_pnode_t*         floor = NULL;
+
+        while ( node )
+        {
+                if ( node->left <= value )
+                {
+                        floor = node;
+                        node = node->rchild;
+                }
+                else
+                {
+                        node = node->lchild;
+                }
+        }
+
+        return floor;
+}
+
+static void
+interval_set_concurrent_publish( interval_set_concurrent_t* ic, interval_pnode_t* root )
+{
+        /*
+                Publish the new root and move to the next epoch. Whatever was
+                retired before the oldest epoch a reader is still in can then
+                be freed.
+         */
+
+        unsigned long   epoch = atomic_load( &ic->epoch );
+        unsigned long   oldest = epoch + 1;
+
+        atomic_store( &ic->root, root );
+        atomic_store( &ic->epoch, epoch + 1 );
+
+        for ( int i = 0; i < INTERVAL_MAX_READERS; i++ )
+        {
+                unsigned long   announced = atomic_load( &ic->readers[i].epoch );
+
+                if ( announced && announced < oldest )
+                {
+                        oldest = announced;
+                }
+        }
+
+        while ( ic->retiredHead < ic->retiredCount && ic->retired[ic->retiredHead].epoch < oldest )
+        {
+                free( ic->retired[ic->retiredHead++].node );
+        }
+
+        if ( ic->retiredHead == ic->retiredCount )
+        {
+                ic->retiredHead = 0;
+                ic->retiredCount = 0;
+        }
+}
+
+void
+interval_set_concurrent_add( interval_set_concurrent_t* ic, int newLeft, int newRight )
+{
+        /*
+                The new interval absorbs the intervals it overlaps or touches:
+                its bounds are widened to theirs, they are split out of the 
+                tree and dropped, and the widened interval is merged back in
+                between what is left on either side.
+         */
+
+        interval_pnode_t*       root;
+        interval_pnode_t*       less;
+        interval_pnode_t*       rest;
+        interval_pnode_t*       covered;
+        const interval_pnode_t* floor;
+
+        if ( newLeft >= newRight )
+        {
+                return;
+        }
+
+        pthread_mutex_lock( &ic->writer );
+
+        ic->version++;
+        root = atomic_load( &ic->root );
+
+        floor = interval_pnode_floor( root, newLeft );
+
+        if ( floor && newLeft <= floor->right )
+        {
+                newLeft = floor->left;
+        }
+
+        floor = interval_pnode_floor( root, newRight );
+
+        if ( floor && newRight < floor->right )
+        {
+                newRight = floor->right;
+        }
+
+        interval_pnode_split( ic, root, newLeft, &less, &rest );
+        interval_pnode_split( ic, rest, newRight, &covered, &rest );
+        interval_pnode_drop( ic, covered );
+
+        root = interval_pnode_merge( ic, less, interval_pnode_create( ic, newLeft, newRight ) );
+        root = interval_pnode_merge( ic, root, rest );
+
+        interval_set_concurrent_publish( ic, root );
+
+        pthread_mutex_unlock( &ic->writer );
+}
+
+void
+interval_set_concurrent_remove( interval_set_concurrent_t* ic, int newLeft, int newRight )
+{
+        /*
+                Every interval overlapping [newLeft, newRight) is split out of
+                the tree and dropped, and the parts of the first and last of
+                them that stick out of the range are merged back in.
+         */
+
+        interval_pnode_t*       root;
+        interval_pnode_t*       less;
+        interval_pnode_t*       rest;
+        interval_pnode_t*       covered;
+        const interval_pnode_t* first;
+        const interval_pnode_t* last;
+        int                     start = newLeft;
+        int                     keepLeft = 0;
+        int                     keepRight = 0;
+        int                     leftPiece = 0;
+        int                     rightPiece = 0;
+
+        if ( newLeft >= newRight )
+        {
+                return;
+        }
+
+        pthread_mutex_lock( &ic->writer );
+
+        ic->version++;
+        root = atomic_load( &ic->root );
+
+        first = interval_pnode_floor( root, newLeft );
+        last = interval_pnode_floor( root, newRight - 1 );
+
+        if ( first && first->right > newLeft )
+        {
+                start = first->left;
+                keepLeft = first->left < newLeft;
+                leftPiece = first->left;
+        }
+
+        if ( last && last->right > newRight )
+        {
+                keepRight = 1;
+                rightPiece = last->right;
+        }
+
+        interval_pnode_split( ic, root, start, &less, &rest );
+        interval_pnode_split( ic, rest, newRight, &covered, &rest );
+        interval_pnode_drop( ic, covered );
+
+        if ( keepLeft )
+        {
+                less = interval_pnode_merge( ic, less, interval_pnode_create( ic, leftPiece, newLeft ) );
+        }
+
+        if ( keepRight )
+        {
+                rest = interval_pnode_merge( ic, interval_pnode_create( ic, newRight, rightPiece ), rest );
+        }
+
+        root = interval_pnode_merge( ic, less, rest );
+
+        interval_set_concurrent_publish( ic, root );
+
+        pthread_mutex_unlock( &ic->writer );
+}
+
+int
+interval_snapshot_contains( interval_snapshot_t snapshot, int value )
+{
+        const interval_pnode_t*         floor = interval_pnode_floor( snapshot.root, value );
+
+        return floor && value < floor->right;
+}
+
+int
+interval_snapshot_overlaps( interval_snapshot_t snapshot, int newLeft, int newRight )
+{
+        const interval_pnode_t*         floor;
+
+        if ( newLeft >= newRight )
+        {
+                return 0;
+        }
+
+        floor = interval_pnode_floor( snapshot.root, newRight - 1 );
+
+        return floor && newLeft < floor->right;
+}
+
+static void
+interval_pnode_format( const interval_pnode_t* node, interval_text_t* text )
+{
+        if ( node )
+        {
+                interval_pnode_format( node->lchild, text );
+                interval_text_interval( text, node->left, node->right );
+                interval_pnode_format( node->rchild, text );
+        }
+}
+
+void
+interval_snapshot_print( interval_snapshot_t snapshot )
+{
+        interval_text_t         text = { 0 };
+
+        interval_text_append( &text, "{", 1 );
+        interval_pnode_format( snapshot.root, &text );
+        interval_text_append( &text, "}\n", 2 );
+        interval_text_flush( &text, stdout );
+}
+
+interval_set_versioned_t*
+interval_set_versioned_create( void )
+{
+        /*
+                Version 0 is the empty set.
+         */
+
+        interval_set_versioned_t*       vs = ( interval_set_versioned_t* ) calloc( 1, sizeof( interval_set_versioned_t ) );
+
+        vs->capacity = 64;
+        vs->versions = ( interval_version_t* ) calloc( vs->capacity, sizeof( interval_version_t ) );
+        vs->versions[0].live = 1;
+        vs->count = 1;
+        vs->seed = 2463534242u;
+
+        return vs;
+}
+
+static void
+interval_vnode_unref( interval_pnode_t* node )
+{
+        /*
+                Drops a reference to a node, freeing it ( and dropping its 
+                references to its children ) if that was the last one. The
+                loop follows the right child rather than recursing on it.
+         */
+
+        while ( node && atomic_fetch_sub( &node->refs, 1 ) == 1 )
+        {
+                interval_pnode_t*       next = node->rchild;
+
+                interval_vnode_unref( node->lchild );
+                free( node );
+                node = next;
+        }
+}
+
+static interval_pnode_t*
+interval_vnode_own( interval_pnode_t* node )
+{
+        /*
+                Takes over the caller's reference to a node and returns a node
+                that may be modified: the node itself if nothing else refers 
+                to it ( it was created by the write in progress ), or else a
+                copy of it that refers to the same children.
+         */
+
+        interval_pnode_t*       copy;
+
+        if ( atomic_load( &node->refs ) == 1 )
+        {
+                return node;
+        }
+
+        copy = ( interval_pnode_t* ) malloc( sizeof( interval_pnode_t ) );
+        *copy = *node;
+        atomic_init( &copy->refs, 1 );
+
+        if ( copy->lchild )
+        {
+                atomic_fetch_add( &copy->lchild->refs, 1 );
+        }
+
+        if ( copy->rchild )
+        {
+                atomic_fetch_add( &copy->rchild->refs, 1 );
+        }
+
+        interval_vnode_unref( node );
+
+        return copy;
+}
+
+static void
+interval_vnode_split( interval_pnode_t* node,
+                int key,
+                interval_pnode_t** less,
+                interval_pnode_t** rest )
+{
+        /*
+                As interval_pnode_split, consuming the reference to 'node' 
+                and handing out one to each half.
+         */
+
+        if ( !node )
+        {
+                *less = NULL;
+                *rest = NULL;
+                return;
+        }
+
+        node = interval_vnode_own( node );
+
+        if ( node->left < key )
+        {
+                interval_vnode_split( node->rchild, key, &node->rchild, rest );
+                *less = node;
+        }
+        else
+        {
+                interval_vnode_split( node->lchild, key, less, &node->lchild );
+                *rest = node;
+        }
+}
+
+static interval_pnode_t*
+interval_vnode_merge( interval_pnode_t* less, interval_pnode_t* rest )
+{
+        interval_pnode_t*       node;
+
+        if ( !less || !rest )
+        {
+                return less ? less : rest;
+        }
+
+        if ( less->priority > rest->priority )
+        {
+                node = interval_vnode_own( less );
+                node->rchild = interval_vnode_merge( node->rchild, rest );
+        }
+        else
+        {
+                node = interval_vnode_own( rest );
+                node->lchild = interval_vnode_merge( less, node->lchild );
+        }
+
+        return node;
+}
+
+static interval_pnode_t*
+interval_vnode_create( interval_set_versioned_t* vs, int left, int right )
+{
+        interval_pnode_t*       node = ( interval_pnode_t* ) calloc( 1, sizeof( interval_pnode_t ) );
+
+        vs->seed ^= vs->seed << 13;
+        vs->seed ^= vs->seed >> 17;
+        vs->seed ^= vs->seed << 5;
+
+        node->left = left;
+        node->right = right;
+        node->priority = vs->seed;
+        atomic_init( &node->refs, 1 );
+
+        return node;
+}
+
+unsigned long
+interval_set_versioned_current( const interval_set_versioned_t* vs )
+{
+        return vs->base + vs->count - 1;
+}
+
+static interval_pnode_t*
+interval_set_versioned_head( interval_set_versioned_t* vs )
+{
+        /*
+                Returns a new reference to the root of the current version,
+                for a write to consume.
+         */
+
+        interval_pnode_t*       root = vs->versions[vs->count - 1].root;
+
+        if ( root )
+        {
+                atomic_fetch_add( &root->refs, 1 );
+        }
+
+        return root;
+}
+
+static unsigned long
+interval_set_versioned_push( interval_set_versioned_t* vs, interval_pnode_t* root )
+{
+        /*
+                When the array is full, the released slots at its front are
+                reused first. It only doubles if that leaves it more than half
+                full, so each slot is moved O(1) times on average.
+         */
+
+        if ( vs->count == vs->capacity )
+        {
+                vs->count -= vs->first;
+                memmove( vs->versions, vs->versions + vs->first, vs->count * sizeof( interval_version_t ) );
+                vs->base += vs->first;
+                vs->first = 0;
+
+                if ( vs->count * 2 > vs->capacity )
+                {
+                        vs->capacity *= 2;
+                        vs->versions = ( interval_version_t* ) realloc( vs->versions, vs->capacity * sizeof( interval_version_t ) );
+                }
+        }
+
+        vs->versions[vs->count].root = root;
+        vs->versions[vs->count].live = 1;
+
+        return vs->base + vs->count++;
+}
+
+unsigned long
+interval_set_versioned_add( interval_set_versioned_t* vs, int newLeft, int newRight )
+{
+        /*
+                Same steps as interval_set_concurrent_add, except that every
+                node on the changed paths is copied ( the previous version 
+                still refers to it ). Returns the new version, or the current
+                one for an empty range.
+         */
+
+        interval_pnode_t*       root;
+        interval_pnode_t*       less;
+        interval_pnode_t*       rest;
+        interval_pnode_t*       covered;
+        const interval_pnode_t* floor;
+
+        if ( newLeft >= newRight )
+        {
+                return interval_set_versioned_current( vs );
+        }
+
+        root = interval_set_versioned_head( vs );
+
+        floor = interval_pnode_floor( root, newLeft );
+
+        if ( floor && newLeft <= floor->right )
+        {
+                newLeft = floor->left;
+        }
+
+        floor = interval_pnode_floor( root, newRight );
+
+        if ( floor && newRight < floor->right )
+        {
+                newRight = floor->right;
+        }
+
+        interval_vnode_split( root, newLeft, &less, &rest );
+        interval_vnode_split( rest, newRight, &covered, &rest );
+        interval_vnode_unref( covered );
+
+        root = interval_vnode_merge( less, interval_vnode_create( vs, newLeft, newRight ) );
+        root = interval_vnode_merge( root, rest );
+
+        return interval_set_versioned_push( vs, root );
+}
+
+unsigned long
+interval_set_versioned_remove( interval_set_versioned_t* vs, int newLeft, int newRight )
+{
+        /*
+                Same steps as interval_set_concurrent_remove, copying paths 
+                as interval_set_versioned_add does.
+         */
+
+        interval_pnode_t*       root;
+        interval_pnode_t*       less;
+        interval_pnode_t*       rest;
+        interval_pnode_t*       covered;
+        const interval_pnode_t* first;
+        const interval_pnode_t* last;
+        int                     start = newLeft;
+        int                     keepLeft = 0;
+        int                     keepRight = 0;
+        int                     leftPiece = 0;
+        int                     rightPiece = 0;
+
+        if ( newLeft >= newRight )
+        {
+                return interval_set_versioned_current( vs );
+        }
+
+        root = interval_set_versioned_head( vs );
+
+        first = interval_pnode_floor( root, newLeft );
+        last = interval_pnode_floor( root, newRight - 1 );
+
+        if ( first && first->right > newLeft )
+        {
+                start = first->left;
+                keepLeft = first->left < newLeft;
+                leftPiece = first->left;
+        }
+
+        if ( last && last->right > newRight )
+        {
+                keepRight = 1;
+                rightPiece = last->right;
+        }
+
+        interval_vnode_split( root, start, &less, &rest );
+        interval_vnode_split( rest, newRight, &covered, &rest );
+        interval_vnode_unref( covered );
+
+        if ( keepLeft )
+        {
+                less = interval_vnode_merge( less, interval_vnode_create( vs, leftPiece, newLeft ) );
+        }
+
+        if ( keepRight )
+        {
+                rest = interval_vnode_merge( interval_vnode_create( vs, newRight, rightPiece ), rest );
+        }
+
+        root = interval_vnode_merge( less, rest );
+
+        return interval_set_versioned_push( vs, root );
+}
+
+
+int
+interval_set_versioned_get( interval_set_versioned_t* vs, unsigned long version, interval_snapshot_t* snapshot )
+{
+        /*
+                Takes a reference to a version in O(1), so that it can be 
+                read with the interval_snapshot_* functions ( from any 
+                thread ) until it is given back with interval_set_versioned_put.
+                Returns 0 if there is no such version or it was released.
+         */
+
+        interval_pnode_t*       root;
+
+        if ( version < vs->base + vs->first || version - vs->base >= vs->count || !vs->versions[version - vs->base].live )
+        {
+                return 0;
+        }
+
+        root = vs->versions[version - vs->base].root;
+
+        if ( root )
+        {
+                atomic_fetch_add( &root->refs, 1 );
+        }
+
+        snapshot->root = root;
+
+        return 1;
+}
+
+void
+interval_set_versioned_put( interval_snapshot_t snapshot )
+{
+        interval_vnode_unref( ( interval_pnode_t* ) snapshot.root );
+}
+
+void
+interval_set_versioned_release( interval_set_versioned_t* vs, unsigned long version )
+{
+        /*
+                Gives up the set's reference to an old version. Its nodes are
+                freed as soon as no other version or snapshot shares them. The
+                current version stays, as the next write starts from it.
+         */
+
+        interval_version_t*     slot;
+
+        if ( version < vs->base + vs->first || version - vs->base + 1 >= vs->count )
+        {
+                return;
+        }
+
+        slot = &vs->versions[version - vs->base];
+
+        if ( !slot->live )
+        {
+                return;
+        }
+
+        interval_vnode_unref( slot->root );
+
+        slot->root = NULL;
+        slot->live = 0;
+
+        while ( !vs->versions[vs->first].live )
+        {
+                vs->first++;
+        }
+}
+
+void
+interval_set_versioned_free( interval_set_versioned_t* vs )
+{
+        /*
+                Snapshots still held stay valid until they are put back.
+         */
+
+        for ( unsigned long i = vs->first; i < vs->count; i++ )
+        {
+                if ( vs->versions[i].live )
+                {
+                        interval_vnode_unref( vs->versions[i].root );
+                }
+        }
+
+        free( vs->versions );
+        free( vs );
+}
+
+interval_map_t*
+interval_map_create( size_t payloadSize )
+{
+        interval_map_t*         map = ( interval_map_t* ) calloc( 1, sizeof( interval_map_t ) );
+
+        map->payloadSize = payloadSize;
+        map->seed = 2463534242u;
+
+        return map;
+}
+
+static void
+interval_mnode_free_tree( interval_map_t* map, interval_mnode_t* node )
+{
+        if ( node )
+        {
+                interval_mnode_free_tree( map, node->lchild );
+                interval_mnode_free_tree( map, node->rchild );
+                free( node );
+                map->count--;
+        }
+}
+
+void
+interval_map_free( interval_map_t* map )
+{
+        interval_mnode_free_tree( map, map->root );
+        free( map );
+}
+
+static interval_mnode_t*
+interval_mnode_create( interval_map_t* map, int left, int right, const void* payload )
+{
+        interval_mnode_t*       node = ( interval_mnode_t* ) malloc( sizeof( interval_mnode_t ) + map->payloadSize );
+
+        map->seed ^= map->seed << 13;
+        map->seed ^= map->seed >> 17;
+        map->seed ^= map->seed << 5;
+
+        node->left = left;
+        node->right = right;
+        node->priority = map->seed;
+        node->lchild = NULL;
+        node->rchild = NULL;
+        memcpy( node->payload, payload, map->payloadSize );
+        map->count++;
+
+        return node;
+}
+
+static void
+interval_mnode_split( interval_mnode_t* node, int key, interval_mnode_t** less, interval_mnode_t** rest )
+{
+        /*
+                Splits a tree in place into the nodes whose 'left' is less 
+                than 'key' and the rest.
+         */
+
+        if ( !node )
+        {
+                *less = NULL;
+                *rest = NULL;
+                return;
+        }
+
+        if ( node->left < key )
+        {
+                interval_mnode_split( node->rchild, key, &node->rchild, rest );
+                *less = node;
+        }
+        else
+        {
+                interval_mnode_split( node->lchild, key, less, &node->lchild );
+                *rest = node;
+        }
+}
+
+static interval_mnode_t*
+interval_mnode_merge( interval_mnode_t* less, interval_mnode_t* rest )
+{
+        if ( !less || !rest )
+        {
+                return less ? less : rest;
+        }
+
+        if ( less->priority > rest->priority )
+        {
+                less->rchild = interval_mnode_merge( less->rchild, rest );
+                return less;
+        }
+
+        rest->lchild = interval_mnode_merge( less, rest->lchild );
+
+        return rest;
+}
+
+static interval_mnode_t*
+interval_mnode_last( interval_mnode_t* node )
+{
+        while ( node && node->rchild )
+        {
+                node = node->rchild;
+        }
+
+        return node;
+}
+
+static interval_mnode_t*
+interval_mnode_first( interval_mnode_t* node )
+{
+        while ( node && node->lchild )
+        {
+                node = node->lchild;
+        }
+
+        return node;
+}
+
+static void
+interval_map_cut( interval_map_t* map, int newLeft, int newRight, interval_mnode_t** less, interval_mnode_t** rest )
+{
+        /*
+                Takes [newLeft, newRight) out of the map, leaving the nodes 
+                before it in 'less' and those after it in 'rest'. Nodes inside
+                the range are freed, and one reaching into it from either side
+                is trimmed ( or, if it spans the whole range, split in two ).
+         */
+
+        interval_mnode_t*       covered;
+        interval_mnode_t*       last;
+
+        interval_mnode_split( map->root, newLeft, less, rest );
+        interval_mnode_split( *rest, newRight, &covered, rest );
+
+        map->root = NULL;
+
+        /*
+                Whatever sticks out past 'newRight', from the last node before
+                the range or the last one inside it, goes back in as the first
+                node after it.
+         */
+
+        last = covered ? interval_mnode_last( covered ) : interval_mnode_last( *less );
+
+        if ( last && last->right > newRight )
+        {
+                *rest = interval_mnode_merge( interval_mnode_create( map, newRight, last->right, last->payload ), *rest );
+        }
+
+        last = interval_mnode_last( *less );
+
+        if ( last && last->right > newLeft )
+        {
+                last->right = newLeft;
+        }
+
+        interval_mnode_free_tree( map, covered );
+}
+
+void
+interval_map_assign( interval_map_t* map, int newLeft, int newRight, const void* payload )
+{
+        /*
+                Maps [newLeft, newRight) to 'payload', overwriting whatever 
+                the range was mapped to. The new interval absorbs a neighbour
+                that touches it with an equal payload, so that equal runs are 
+                always kept as a single interval. 'payload' may point into 
+                the map itself ( say, from interval_map_get ), so it is copied
+                into the new node before any node is freed.
+         */
+
+        interval_mnode_t*       node;
+        interval_mnode_t*       less;
+        interval_mnode_t*       rest;
+        interval_mnode_t*       neighbour;
+
+        if ( newLeft >= newRight )
+        {
+                return;
+        }
+
+        node = interval_mnode_create( map, newLeft, newRight, payload );
+
+        interval_map_cut( map, newLeft, newRight, &less, &rest );
+
+        neighbour = interval_mnode_last( less );
+
+        if ( neighbour && neighbour->right == newLeft && memcmp( neighbour->payload, node->payload, map->payloadSize ) == 0 )
+        {
+                node->left = neighbour->left;
+                interval_mnode_split( less, node->left, &less, &neighbour );
+                interval_mnode_free_tree( map, neighbour );
+        }
+
+        neighbour = interval_mnode_first( rest );
+
+        if ( neighbour && neighbour->left == newRight && memcmp( neighbour->payload, node->payload, map->payloadSize ) == 0 )
+        {
+                node->right = neighbour->right;
+                interval_mnode_split( rest, node->right, &neighbour, &rest );
+                interval_mnode_free_tree( map, neighbour );
+        }
+
+        map->root = interval_mnode_merge( interval_mnode_merge( less, node ), rest );
+}
+
+void
+interval_map_erase( interval_map_t* map, int newLeft, int newRight )
+{
+        /*
+                Unmaps [newLeft, newRight).
+         */
+
+        interval_mnode_t*       less;
+        interval_mnode_t*       rest;
+
+        if ( newLeft >= newRight )
+        {
+                return;
+        }
+
+        interval_map_cut( map, newLeft, newRight, &less, &rest );
+
+        map->root = interval_mnode_merge( less, rest );
+}
+
+const void*
+interval_map_find( const interval_map_t* map, int value, int* left, int* right )
+{
+        /*
+                Returns the payload 'value' is mapped to, pointing into the 
+                map ( valid until the map changes ), and the bounds of its 
+                interval. Returns NULL if 'value' is not mapped.
+         */
+
+        const interval_mnode_t* node = map->root;
+        const interval_mnode_t* floor = NULL;
+
+        while ( node )
+        {
+                if ( node->left <= value )
+                {
+                        floor = node;
+                        node = node->rchild;
+                }
+                else
+                {
+                        node = node->lchild;
+                }
+        }
+
+        if ( !floor || value >= floor->right )
+        {
+                return NULL;
+        }
+
+        *left = floor->left;
+        *right = floor->right;
+
+        return floor->payload;
+}
+
+const void*
+interval_map_get( const interval_map_t* map, int value )
+{
+        int     left;
+        int     right;
+
+        return interval_map_find( map, value, &left, &right );
+}
+
+static void
+interval_mnode_foreach( const interval_mnode_t* node,
+                void ( *callback )( int left, int right, const void* payload, void* context ),
+                void* context )
+{
+        if ( node )
+        {
+                interval_mnode_foreach( node->lchild, callback, context );
+                callback( node->left, node->right, node->payload, context );
+                interval_mnode_foreach( node->rchild, callback, context );
+        }
+}
+
+void
+interval_map_foreach( const interval_map_t* map,
+                void ( *callback )( int left, int right, const void* payload, void* context ),
+                void* context )
+{
+        /*
+                Calls 'callback' for every interval of the map in order.
+         */
+
+        interval_mnode_foreach( map->root, callback, context );
+}
+
+interval_set_sharded_t*
+interval_set_sharded_create( int backend, int count, int lo, int hi )
+{
+        /*
+                Creates 'count' shards splitting [lo, hi) evenly. The first
+                and last shards also take everything below and above it.
+         */
+
+        interval_set_sharded_t*         ss = ( interval_set_sharded_t* ) calloc( 1, sizeof( interval_set_sharded_t ) );
+
+        if ( count < 1 )
+        {
+                count = 1;
+        }
+
+        ss->backend = backend;
+        ss->count = count;
+        ss->shards = ( interval_shard_t* ) calloc( count, sizeof( interval_shard_t ) );
+
+        pthread_rwlock_init( &ss->layout, NULL );
+
+        for ( int i = 0; i < count; i++ )
+        {
+                ss->shards[i].set = interval_set_create( backend );
+                ss->shards[i].lo = i ? ( int ) ( lo + ( ( int64_t ) hi - lo ) * i / count ) : INT32_MIN;
+                atomic_init( &ss->shards[i].ops, 0 );
+                pthread_mutex_init( &ss->shards[i].lock, NULL );
+        }
+
+        return ss;
+}
+
+void
+interval_set_sharded_free( interval_set_sharded_t* ss )
+{
+        for ( int i = 0; i < ss->count; i++ )
+        {
+                interval_set_free( ss->shards[i].set );
+                pthread_mutex_destroy( &ss->shards[i].lock );
+        }
+
+        pthread_rwlock_destroy( &ss->layout );
+        free( ss->shards );
+        free( ss );
+}
+
+static int
+interval_set_sharded_find( interval_set_sharded_t* ss, int value )
+{
+        /*
+                Index of the shard whose range contains 'value'.
+         */
+
+        int     lo = 0;
+        int     hi = ss->count - 1;
+
+        while ( lo < hi )
+        {
+                int     mid = lo + ( hi - lo + 1 ) / 2;
+
+                if ( ss->shards[mid].lo <= value )
+                {
+                        lo = mid;
+                }
+                else
+                {
+                        hi = mid - 1;
+                }
+        }
+
+        return lo;
+}
+
+static void
+interval_set_sharded_apply( interval_set_sharded_t* ss, int kind, int newLeft, int newRight )
+{
+        int     first;
+        int     last;
+
+        if ( newLeft >= newRight )
+        {
+                return;
+        }
+
+        pthread_rwlock_rdlock( &ss->layout );
+
+        first = interval_set_sharded_find( ss, newLeft );
+        last = interval_set_sharded_find( ss, newRight - 1 );
+
+        for ( int i = first; i <= last; i++ )
+        {
+                pthread_mutex_lock( &ss->shards[i].lock );
+        }
+
+        for ( int i = first; i <= last; i++ )
+        {
+                interval_shard_t*       shard = &ss->shards[i];
+                int                     left = newLeft > shard->lo ? newLeft : shard->lo;
+                int                     right = newRight;
+
+                if ( i + 1 < ss->count && ss->shards[i + 1].lo < right )
+                {
+                        right = ss->shards[i + 1].lo;
+                }
+
+                if ( kind == INTERVAL_OP_ADD )
+                {
+                        interval_set_add( shard->set, left, right, SHOULD_NOT_PRINT );
+                }
+                else
+                {
+                        interval_set_remove( shard->set, left, right, SHOULD_NOT_PRINT );
+                }
+
+                atomic_fetch_add_explicit( &shard->ops, 1, memory_order_relaxed );
+        }
+
+        for ( int i = last; i >= first; i-- )
+        {
+                pthread_mutex_unlock( &ss->shards[i].lock );
+        }
+
+        pthread_rwlock_unlock( &ss->layout );
+}
+
+void
+interval_set_sharded_add( interval_set_sharded_t* ss, int newLeft, int newRight )
+{
+        interval_set_sharded_apply( ss, INTERVAL_OP_ADD, newLeft, newRight );
+}
+
+void
+interval_set_sharded_remove( interval_set_sharded_t* ss, int newLeft, int newRight )
+{
+        interval_set_sharded_apply( ss, INTERVAL_OP_REMOVE, newLeft, newRight );
+}
+
+int
+interval_set_sharded_contains( interval_set_sharded_t* ss, int value )
+{
+        int                     found;
+        interval_shard_t*       shard;
+
+        pthread_rwlock_rdlock( &ss->layout );
+
+        shard = &ss->shards[interval_set_sharded_find( ss, value )];
+
+        pthread_mutex_lock( &shard->lock );
+        found = interval_set_contains( shard->set, value );
+        pthread_mutex_unlock( &shard->lock );
+
+        pthread_rwlock_unlock( &ss->layout );
+
+        return found;
+}
+
+static void
+interval_set_sharded_collect( interval_set_sharded_t* ss, interval_array_t* result, double* weights )
+{
+        /*
+                Concatenates the shards into one sorted array, merging the 
+                intervals that were cut at a shard boundary back together.
+                If 'weights' is given, each resulting interval is also given 
+                its share of the load of the shard it starts in. Must be 
+                called with every shard locked.
+         */
+
+        for ( int i = 0; i < ss->count; i++ )
+        {
+                interval_iter_t         it;
+                int                     left;
+                int                     right;
+                size_t                  intervals = 0;
+                size_t                  before = result->count;
+
+                interval_iter_begin( &it, ss->shards[i].set );
+
+                while ( interval_iter_next( &it, &left, &right ) )
+                {
+                        interval_array_push( result, left, right );
+                        intervals++;
+                }
+
+                if ( weights )
+                {
+                        double  share = intervals ? ( double ) atomic_load( &ss->shards[i].ops ) / intervals : 0;
+
+                        for ( size_t k = before; k < result->count; k++ )
+                        {
+                                weights[k] = share;
+                        }
+                }
+        }
+}
+
+void
+interval_set_sharded_foreach( interval_set_sharded_t* ss,
+                void ( *callback )( int left, int right, void* context ),
+                void* context )
+{
+        /*
+                Calls 'callback' for every interval of the set in order, as
+                one consistent snapshot ( all shards are locked meanwhile ).
+         */
+
+        interval_array_t        all = { 0 };
+
+        pthread_rwlock_rdlock( &ss->layout );
+
+        for ( int i = 0; i < ss->count; i++ )
+        {
+                pthread_mutex_lock( &ss->shards[i].lock );
+        }
+
+        interval_set_sharded_collect( ss, &all, NULL );
+
+        for ( int i = ss->count - 1; i >= 0; i-- )
+        {
+                pthread_mutex_unlock( &ss->shards[i].lock );
+        }
+
+        pthread_rwlock_unlock( &ss->layout );
+
+        for ( size_t k = 0; k < all.count; k++ )
+        {
+                callback( all.lefts[k], all.rights[k], context );
+        }
+
+        free( all.lefts );
+        free( all.rights );
+}
+
+static void
+interval_set_sharded_format( int left, int right, void* context )
+{
+        interval_text_interval( ( interval_text_t* ) context, left, right );
+}
+
+void
+interval_set_sharded_print( interval_set_sharded_t* ss )
+{
+        interval_text_t         text = { 0 };
+
+        interval_text_append( &text, "{", 1 );
+        interval_set_sharded_foreach( ss, interval_set_sharded_format, &text );
+        interval_text_append( &text, "}\n", 2 );
+        interval_text_flush( &text, stdout );
+}
+
+int
+interval_set_sharded_rebalance( interval_set_sharded_t* ss )
+{
+        /*
+                Moves the shard boundaries so that every shard gets about the
+                same share of the load seen since the last rebalance, where a
+                shard's load is spread evenly over the intervals it holds. 
+                Boundaries are placed on interval left values, so no interval
+                gets cut by the new layout. Returns 0 ( and leaves the layout
+                alone ) if there are too few intervals to give every shard a
+                boundary of its own.
+         */
+
+        interval_array_t        all = { 0 };
+        double*                 weights;
+        double                  total = 0;
+        double                  seen = 0;
+        int*                    bounds = ( int* ) malloc( ss->count * sizeof( int ) );
+        size_t                  intervals = 0;
+        size_t                  k = 0;
+        int                     next = 1;
+        int                     moved = 0;
+
+        pthread_rwlock_wrlock( &ss->layout );
+
+        for ( int i = 0; i < ss->count; i++ )
+        {
+                interval_set_t*         set = ss->shards[i].set;
+
+                if ( set->backend == INTERVAL_BACKEND_ARRAY )
+                {
+                        intervals += set->array.count;
+                }
+                else if ( set->backend == INTERVAL_BACKEND_BLOCK )
+                {
+                        intervals += set->blocks.intervals;
+                }
+                else
+                {
+                        interval_iter_t         it;
+                        int                     left;
+                        int                     right;
+
+                        interval_iter_begin( &it, set );
+
+                        while ( interval_iter_next( &it, &left, &right ) )
+                        {
+                                intervals++;
+                        }
+                }
+        }
+
+        weights = ( double* ) malloc( ( intervals ? intervals : 1 ) * sizeof( double ) );
+
+        interval_set_sharded_collect( ss, &all, weights );
+
+        for ( k = 0; k < all.count; k++ )
+        {
+                total += weights[k];
+        }
+
+        bounds[0] = INT32_MIN;
+
+        for ( k = 0; k < all.count && next < ss->count; k++ )
+        {
+                if ( total > 0 && seen >= total * next / ss->count && all.lefts[k] > bounds[next - 1] )
+                {
+                        bounds[next++] = all.lefts[k];
+                }
+
+                seen += weights[k];
+        }
+
+        if ( next == ss->count )
+        {
+                k = 0;
+
+                for ( int i = 0; i < ss->count; i++ )
+                {
+                        interval_array_t        part = { 0 };
+
+                        while ( k < all.count && ( i + 1 == ss->count || all.lefts[k] < bounds[i + 1] ) )
+                        {
+                                interval_array_push( &part, all.lefts[k], all.rights[k] );
+                                k++;
+                        }
+
+                        interval_set_assign( ss->shards[i].set, &part );
+                        ss->shards[i].lo = bounds[i];
+                        atomic_store( &ss->shards[i].ops, 0 );
+                }
+
+                moved = 1;
+        }
+
+        pthread_rwlock_unlock( &ss->layout );
+
+        free( bounds );
+        free( weights );
+        free( all.lefts );
+        free( all.rights );
+
+        return moved;
+}
+
+int
+interval_set_sharded_skewed( interval_set_sharded_t* ss, double factor )
+{
+        /*
+                Whether the busiest shard has seen more than 'factor' times
+                the average load since the last rebalance.
+         */
+
+        unsigned long   total = 0;
+        unsigned long   busiest = 0;
+
+        for ( int i = 0; i < ss->count; i++ )
+        {
+                unsigned long   ops = atomic_load( &ss->shards[i].ops );
+
+                total += ops;
+
+                if ( ops > busiest )
+                {
+                        busiest = ops;
+                }
+        }
+
+        return total && busiest > factor * total / ss->count;
+}
+
+static const char*
+interval_parse_int( const char* p, const char* end, int* value )
+{
+        /*
+                Parses an optionally signed decimal integer after any spaces,
+                returning where it stopped ( or NULL if there was no number ).
+         */
+
+        int             negative = 0;
+        unsigned int    magnitude = 0;
+        const char*     digits;
+
+        while ( p < end && ( *p == ' ' || *p == '\t' ) )
+        {
+                p++;
+        }
+
+        if ( p < end && ( *p == '-' || *p == '+' ) )
+        {
+                negative = ( *p == '-' );
+                p++;
+        }
+
+        digits = p;
+
+        while ( p < end && *p >= '0' && *p <= '9' )
+        {
+                magnitude = magnitude * 10 + ( unsigned int ) ( *p - '0' );
+                p++;
+        }
+
+        if ( p == digits )
+        {
+                return NULL;
+        }
+
+        *value = ( int ) ( negative ? 0u - magnitude : magnitude );
+
+        return p;
+}
+
+static int
+interval_replay_line( interval_set_t* is, const char* p, const char* end, int should_print )
+{
+        /*
+                Applies one "A left right" or "R left right" line. Returns 0 
+                for a "Q" line, which ends the input. Blank or malformed lines
+                are skipped.
+         */
+
+        int     left;
+        int     right;
+        char    operation;
+
+        while ( p < end && ( *p == ' ' || *p == '\t' || *p == '\r' ) )
+        {
+                p++;
+        }
+
+        if ( p == end )
+        {
+                return 1;
+        }
+
+        operation = *p++;
+
+        if ( operation == 'Q' )
+        {
+                return 0;
+        }
+
+        if ( !( p = interval_parse_int( p, end, &left ) ) || !interval_parse_int( p, end, &right ) )
+        {
+                return 1;
+        }
+
+        if ( operation == INTERVAL_OP_ADD )
+        {
+                interval_set_add( is, left, right, should_print );
+        }
+        else if ( operation == INTERVAL_OP_REMOVE )
+        {
+                interval_set_remove( is, left, right, should_print );
+        }
+
+        return 1;
+}
+
+static size_t
+interval_replay_text( interval_set_t* is, const char* p, const char* end, int final, int should_print, int* quit )
+{
+        /*
+                Applies every complete line in [p, end), plus the trailing 
+                line without a newline if this is the 'final' chunk. Returns
+                how many bytes were consumed.
+         */
+
+        const char*     start = p;
+
+        while ( p < end && !*quit )
+        {
+                const char*     eol = ( const char* ) memchr( p, '\n', end - p );
+
+                if ( !eol )
+                {
+                        if ( !final )
+                        {
+                                break;
+                        }
+
+                        eol = end;
+                }
+
+                *quit = !interval_replay_line( is, p, eol, should_print );
+
+                p = ( eol < end ) ? eol + 1 : end;
+        }
+
+        return p - start;
+}
+
+int
+interval_set_replay( interval_set_t* is, const char* path, int binary, int should_print )
+{
+        /*
+                Applies the operations in the file at 'path' ( or stdin for
+                "-" ) to the set, either as "A l r" / "R l r" text lines or as
+                binary interval_op_t records. Regular files are mmap'd and 
+                anything else is read in large chunks. Returns -1 if the input 
+                could not be read.
+         */
+
+        int             fd = strcmp( path, "-" ) == 0 ? STDIN_FILENO : open( path, O_RDONLY );
+        struct stat     st;
+        int             quit = 0;
+        char*           buf;
+        size_t          used = 0;
+        ssize_t         got = 0;
+
+        if ( fd < 0 )
+        {
+                return -1;
+        }
+
+        if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size > 0 )
+        {
+                void*   map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+                if ( map != MAP_FAILED )
+                {
+                        madvise( map, st.st_size, MADV_SEQUENTIAL );
+
+                        if ( binary && !should_print && !is->feed && !is->feedBuffer )
+                        {
+                                /*
+                                        Nobody watches the operations one at
+                                        a time, so replay them in parallel.
+                                 */
+
+                                interval_set_replay_ops( is, ( const interval_op_t* ) map, st.st_size / sizeof( interval_op_t ) );
+                        }
+                        else if ( binary )
+                        {
+                                interval_replay_binary( is, ( const interval_op_t* ) map, st.st_size / sizeof( interval_op_t ), should_print );
+                        }
+                        else
+                        {
+                                interval_replay_text( is, ( const char* ) map, ( const char* ) map + st.st_size, 1, should_print, &quit );
+                        }
+
+                        munmap( map, st.st_size );
+
+                        if ( fd != STDIN_FILENO )
+                        {
+                                close( fd );
+                        }
+
+                        return 0;
+                }
+        }
+
+        buf = ( char* ) malloc( INTERVAL_REPLAY_CHUNK );
+
+        while ( !quit && ( got = read( fd, buf + used, INTERVAL_REPLAY_CHUNK - used ) ) > 0 )
+        {
+                size_t  consumed;
+
+                used += got;
+
+                if ( binary )
+                {
+                        consumed = used / sizeof( interval_op_t ) * sizeof( interval_op_t );
+                        interval_replay_binary( is, ( const interval_op_t* ) buf, used / sizeof( interval_op_t ), should_print );
+                }
+                else
+                {
+                        consumed = interval_replay_text( is, buf, buf + used, used == INTERVAL_REPLAY_CHUNK && !memchr( buf, '\n', used ), should_print, &quit );
+                }
+
+                memmove( buf, buf + consumed, used - consumed );
+                used -= consumed;
+        }
+
+        if ( !quit && !binary && used )
+        {
+                interval_replay_text( is, buf, buf + used, 1, should_print, &quit );
+        }
+
+        free( buf );
+
+        if ( fd != STDIN_FILENO )
+        {
+                close( fd );
+        }
+
+        return got < 0 ? -1 : 0;
+}
+
+int
+interval_image_open( interval_image_t* image, const char* path )
+{
+        /*
+                Maps the snapshot at 'path' and points 'lefts' and 'rights' 
+                into the mapping, without reading or copying the intervals.
+                Returns -1 ( with errno set, EINVAL for a file that is not a
+                snapshot ) on failure.
+         */
+
+        int                             fd = open( path, O_RDONLY );
+        struct stat                     st;
+        const interval_image_header_t*  header;
+
+        memset( image, 0, sizeof( interval_image_t ) );
+
+        if ( fd < 0 )
+        {
+                return -1;
+        }
+
+        if ( fstat( fd, &st ) < 0 )
+        {
+                close( fd );
+                return -1;
+        }
+
+        if ( ( size_t ) st.st_size < sizeof( interval_image_header_t ) )
+        {
+                close( fd );
+                errno = EINVAL;
+                return -1;
+        }
+
+        image->size = st.st_size;
+        image->map = mmap( NULL, image->size, PROT_READ, MAP_SHARED, fd, 0 );
+
+        close( fd );
+
+        if ( image->map == MAP_FAILED )
+        {
+                image->map = NULL;
+                return -1;
+        }
+
+        header = ( const interval_image_header_t* ) image->map;
+
+        if ( memcmp( header->magic, INTERVAL_IMAGE_MAGIC, sizeof( header->magic ) ) != 0 
+                        || header->version != INTERVAL_IMAGE_VERSION
+                        || header->headerSize != sizeof( interval_image_header_t )
+                        || header->count > ( image->size - sizeof( interval_image_header_t ) ) / ( 2 * sizeof( int ) ) )
+        {
+                munmap( image->map, image->size );
+                memset( image, 0, sizeof( interval_image_t ) );
+                errno = EINVAL;
+                return -1;
+        }
+
+        image->count = header->count;
+        image->lefts = ( const int* ) ( header + 1 );
+        image->rights = image->lefts + image->count;
+
+        return 0;
+}
+
+void
+interval_image_close( interval_image_t* image )
+{
+        if ( image->map )
+        {
+                munmap( image->map, image->size );
+        }
+
+        memset( image, 0, sizeof( interval_image_t ) );
+}
+
+int
+interval_image_contains( const interval_image_t* image, int value )
+{
+        size_t  i = interval_array_upper_bound( image->lefts, image->count, value );
+
+        return i > 0 && value < image->rights[i - 1];
+}
+
+int
+interval_set_save( interval_set_t* is, const char* path )
+{
+        /*
+                Writes a snapshot of the set to 'path'. The snapshot goes to a
+                temporary file first, which is synced and renamed over 'path',
+                so a crash leaves either the old snapshot or the new one.
+                Returns -1 ( with errno set ) on failure.
+         */
+
+        interval_image_header_t header = { { 0 }, INTERVAL_IMAGE_VERSION, sizeof( interval_image_header_t ), 0, 0 };
+        size_t                  length = strlen( path );
+        char*                   temp = ( char* ) malloc( length + 5 );
+        int                     owned;
+        interval_array_t        a = interval_set_flatten( is, &owned );
+        FILE*                   out;
+        int                     status = -1;
+
+        memcpy( header.magic, INTERVAL_IMAGE_MAGIC, sizeof( header.magic ) );
+        header.count = a.count;
+
+        memcpy( temp, path, length );
+        memcpy( temp + length, ".tmp", 5 );
+
+        out = fopen( temp, "wb" );
+
+        if ( out )
+        {
+                if ( fwrite( &header, sizeof( header ), 1, out ) == 1
+                                && fwrite( a.lefts, sizeof( int ), a.count, out ) == a.count
+                                && fwrite( a.rights, sizeof( int ), a.count, out ) == a.count
+                                && fflush( out ) == 0
+                                && fsync( fileno( out ) ) == 0 )
+                {
+                        status = 0;
+                }
+
+                if ( fclose( out ) != 0 )
+                {
+                        status = -1;
+                }
+
+                if ( status == 0 )
+                {
+                        status = rename( temp, path );
+                }
+                else
+                {
+                        unlink( temp );
+                }
+        }
+
+        if ( owned )
+        {
+                free( a.lefts );
+                free( a.rights );
+        }
+
+        free( temp );
+
+        return status;
+}
+
+interval_set_t*
+interval_set_load( int backend, const char* snapshot, const char* log )
+{
+        /*
+                Restores a set from the snapshot at 'snapshot' and then 
+                replays the operations in 'log' on top of it. Either file may
+                be missing ( or NULL ), which counts as empty. The snapshot is
+                mapped and the set is built from it in one linear pass, so the
+                cost is the snapshot's page-in plus the length of the log.
+                Returns NULL ( with errno set ) if a file can't be read.
+         */
+
+        interval_set_t*         is = interval_set_create( backend );
+        interval_image_t        image;
+
+        if ( snapshot && interval_image_open( &image, snapshot ) == 0 )
+        {
+                madvise( image.map, image.size, MADV_SEQUENTIAL );
+
+                if ( backend == INTERVAL_BACKEND_ARRAY )
+                {
+                        is->array.count = image.count;
+                        is->array.capacity = image.count;
+                        is->array.lefts = ( int* ) malloc( ( image.count ? image.count : 1 ) * sizeof( int ) );
+                        is->array.rights = ( int* ) malloc( ( image.count ? image.count : 1 ) * sizeof( int ) );
+
+                        memcpy( is->array.lefts, image.lefts, image.count * sizeof( int ) );
+                        memcpy( is->array.rights, image.rights, image.count * sizeof( int ) );
+                }
+                else if ( backend == INTERVAL_BACKEND_BLOCK )
+                {
+                        interval_blocks_build( is, image.lefts, image.rights, image.count );
+                }
+                else if ( backend == INTERVAL_BACKEND_HYBRID )
+                {
+                        interval_chunks_build( is, image.lefts, image.rights, image.count );
+                }
+                else
+                {
+                        interval_list_build( is, image.lefts, image.rights, image.count );
+                }
+
+                interval_image_close( &image );
+        }
+        else if ( snapshot && errno != ENOENT )
+        {
+                interval_set_free( is );
+                return NULL;
+        }
+
+        if ( log && interval_set_replay( is, log, 1, SHOULD_NOT_PRINT ) < 0 && errno != ENOENT )
+        {
+                interval_set_free( is );
+                return NULL;
+        }
+
+        return is;
+}
+
+interval_log_t*
+interval_log_open( const char* path )
+{
+        /*
+                Opens ( or creates ) the log at 'path' for appending. A 
+                partial record left at the end by a crash is cut off first.
+         */
+
+        interval_log_t*         log;
+        struct stat             st;
+        int                     fd = open( path, O_WRONLY | O_APPEND | O_CREAT, 0644 );
+
+        if ( fd < 0 )
+        {
+                return NULL;
+        }
+
+        if ( fstat( fd, &st ) == 0 && st.st_size % sizeof( interval_op_t ) )
+        {
+                if ( ftruncate( fd, st.st_size - st.st_size % sizeof( interval_op_t ) ) < 0 )
+                {
+                        close( fd );
+                        return NULL;
+                }
+        }
+
+        log = ( interval_log_t* ) malloc( sizeof( interval_log_t ) );
+        log->fd = fd;
+        log->count = 0;
+
+        return log;
+}
+
+int
+interval_log_sync( interval_log_t* log )
+{
+        /*
+                Writes out the buffered operations and waits for them to 
+                reach the disk. Returns -1 ( with errno set ) on failure.
+         */
+
+        const char*     p = ( const char* ) log->buffer;
+        size_t          left = log->count * sizeof( interval_op_t );
+
+        while ( left )
+        {
+                ssize_t         wrote = write( log->fd, p, left );
+
+                if ( wrote < 0 )
+                {
+                        if ( errno == EINTR )
+                        {
+                                continue;
+                        }
+
+                        return -1;
+                }
+
+                p += wrote;
+                left -= wrote;
+        }
+
+        log->count = 0;
+
+        return fdatasync( log->fd );
+}
+
+int
+interval_log_append( interval_log_t* log, int kind, int left, int right )
+{
+        /*
+                Buffers one operation, writing the buffer out when it fills.
+                Call interval_log_sync once the operation must be durable.
+         */
+
+        if ( log->count == INTERVAL_LOG_BUFFER && interval_log_sync( log ) < 0 )
+        {
+                return -1;
+        }
+
+        log->buffer[log->count].kind = kind;
+        log->buffer[log->count].left = left;
+        log->buffer[log->count].right = right;
+        log->count++;
+
+        return 0;
+}
+
+int
+interval_log_close( interval_log_t* log )
+{
+        int     status = interval_log_sync( log );
+
+        close( log->fd );
+        free( log );
+
+        return status;
+}
+
+int
+interval_set_checkpoint( interval_set_t* is, const char* snapshot, interval_log_t* log )
+{
+        /*
+                Saves a new snapshot and then empties the log. If we crash in
+                between, the old log gets replayed over the new snapshot on the
+                next load, which is harmless: every add or remove sets its 
+                whole range, so replaying the ops that produced a set onto 
+                that set gives the same set again.
+         */
+
+        if ( interval_log_sync( log ) < 0 || interval_set_save( is, snapshot ) < 0 )
+        {
+                return -1;
+        }
+
+        return ftruncate( log->fd, 0 );
+}
+
+static int
+interval_shared_map( interval_shared_t* sh, const char* name, int writable, uint32_t capacity )
+{
+        /*
+                Opens ( or, for the writer, creates ) the segment 'name' and
+                maps it. Returns -1 ( with errno set, EINVAL for a segment
+                that is not a shared set ) on failure. The writer never 
+                reuses an existing segment: truncating one that readers have
+                mapped would fault them, or show them an empty header. The
+                old name is unlinked and a new object created in its place,
+                so old readers keep the old segment until they detach.
+         */
+
+        int             fd;
+        struct stat     st;
+
+        memset( sh, 0, sizeof( interval_shared_t ) );
+
+        if ( writable && shm_unlink( name ) < 0 && errno != ENOENT )
+        {
+                return -1;
+        }
+
+        fd = shm_open( name, writable ? O_RDWR | O_CREAT | O_EXCL : O_RDONLY, 0644 );
+
+        if ( fd < 0 )
+        {
+                return -1;
+        }
+
+        if ( writable )
+        {
+                sh->size = sizeof( interval_shared_header_t ) + ( ( size_t ) capacity + 1 ) * sizeof( interval_shared_node_t );
+
+                if ( ftruncate( fd, sh->size ) < 0 )
+                {
+                        close( fd );
+                        return -1;
+                }
+        }
+        else
+        {
+                if ( fstat( fd, &st ) < 0 )
+                {
+                        close( fd );
+                        return -1;
+                }
+
+                if ( ( size_t ) st.st_size < sizeof( interval_shared_header_t ) )
+                {
+                        close( fd );
+                        errno = EINVAL;
+                        return -1;
+                }
+
+                sh->size = st.st_size;
+        }
+
+        sh->map = mmap( NULL, sh->size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0 );
+
+        close( fd );
+
+        if ( sh->map == MAP_FAILED )
+        {
+                sh->map = NULL;
+                return -1;
+        }
+
+        sh->header = ( interval_shared_header_t* ) sh->map;
+        sh->nodes = ( interval_shared_node_t* ) ( sh->header + 1 );
+        sh->writable = writable;
+
+        return 0;
+}
+
+int
+interval_shared_create( interval_shared_t* sh, const char* name, uint32_t capacity )
+{
+        /*
+                Creates the segment 'name' with room for 'capacity' intervals
+                ( replacing any segment of that name ) and maps it for
+                writing. The calling process is the writer. Returns -1 ( with
+                errno set ) on failure.
+         */
+
+        if ( interval_shared_map( sh, name, 1, capacity ) < 0 )
+        {
+                return -1;
+        }
+
+        memcpy( sh->header->magic, INTERVAL_SHARED_MAGIC, sizeof( sh->header->magic ) );
+        sh->header->version = INTERVAL_SHARED_VERSION;
+        sh->header->headerSize = sizeof( interval_shared_header_t );
+        sh->header->capacity = capacity;
+        sh->header->seed = 2463534242u;
+        atomic_store( &sh->header->sequence, 0 );
+
+        return 0;
+}
+
+int
+interval_shared_attach( interval_shared_t* sh, const char* name )
+{
+        /*
+                Maps an existing segment read-only, for querying. Returns -1
+                ( with errno set ) on failure.
+         */
+
+        const interval_shared_header_t* header;
+
+        if ( interval_shared_map( sh, name, 0, 0 ) < 0 )
+        {
+                return -1;
+        }
+
+        header = sh->header;
+
+        if ( memcmp( header->magic, INTERVAL_SHARED_MAGIC, sizeof( header->magic ) ) != 0 
+                        || header->version != INTERVAL_SHARED_VERSION
+                        || header->headerSize != sizeof( interval_shared_header_t )
+                        || header->capacity > ( sh->size - sizeof( interval_shared_header_t ) ) / sizeof( interval_shared_node_t ) - 1 )
+        {
+                munmap( sh->map, sh->size );
+                memset( sh, 0, sizeof( interval_shared_t ) );
+                errno = EINVAL;
+                return -1;
+        }
+
+        return 0;
+}
+
+void
+interval_shared_detach( interval_shared_t* sh )
+{
+        /*
+                Unmaps the segment. It stays around for other processes until
+                interval_shared_unlink removes its name and the last one 
+                unmaps it.
+         */
+
+        if ( sh->map )
+        {
+                munmap( sh->map, sh->size );
+        }
+
+        memset( sh, 0, sizeof( interval_shared_t ) );
+}
+
+int
+interval_shared_unlink( const char* name )
+{
+        return shm_unlink( name );
+}
+
+/*
+        The writer changes nodes that readers may be loading at the same
+        time, so every field a reader looks at ( 'left', 'right', the child
+        links and the header's 'root' ) is stored atomically. The seqlock
+        only tells a reader to retry, it does not keep the accesses apart.
+        'less' and 'rest' below may point at a child link.
+ */
+
+static void
+interval_shared_split( interval_shared_node_t* nodes, uint32_t node, int key, uint32_t* less, uint32_t* rest )
+{
+        /*
+                Splits a subtree in place into the nodes whose 'left' is less
+                than 'key' and the rest.
+         */
+
+        if ( !node )
+        {
+                __atomic_store_n( less, 0, __ATOMIC_RELAXED );
+                __atomic_store_n( rest, 0, __ATOMIC_RELAXED );
+                return;
+        }
+
+        if ( nodes[node].left < key )
+        {
+                interval_shared_split( nodes, nodes[node].rchild, key, &nodes[node].rchild, rest );
+                __atomic_store_n( less, node, __ATOMIC_RELAXED );
+        }
+        else
+        {
+                interval_shared_split( nodes, nodes[node].lchild, key, less, &nodes[node].lchild );
+                __atomic_store_n( rest, node, __ATOMIC_RELAXED );
+        }
+}
+
+static uint32_t
+interval_shared_merge( interval_shared_node_t* nodes, uint32_t less, uint32_t rest )
+{
+        if ( !less || !rest )
+        {
+                return less ? less : rest;
+        }
+
+        if ( nodes[less].priority > nodes[rest].priority )
+        {
+                __atomic_store_n( &nodes[less].rchild, interval_shared_merge( nodes, nodes[less].rchild, rest ), __ATOMIC_RELAXED );
+                return less;
+        }
+
+        __atomic_store_n( &nodes[rest].lchild, interval_shared_merge( nodes, less, nodes[rest].lchild ), __ATOMIC_RELAXED );
+
+        return rest;
+}
+
+static void
+interval_shared_drop( interval_shared_t* sh, uint32_t node )
+{
+        if ( node )
+        {
+                interval_shared_drop( sh, sh->nodes[node].lchild );
+                interval_shared_drop( sh, sh->nodes[node].rchild );
+
+                __atomic_store_n( &sh->nodes[node].lchild, sh->header->free, __ATOMIC_RELAXED );
+                sh->header->free = node;
+                sh->header->count--;
+        }
+}
+
+static uint32_t
+interval_shared_create_node( interval_shared_t* sh, int left, int right )
+{
+        interval_shared_header_t*       header = sh->header;
+        uint32_t                        node = header->free;
+
+        if ( node )
+        {
+                header->free = sh->nodes[node].lchild;
+        }
+        else
+        {
+                node = ++header->used;
+        }
+
+        header->seed ^= header->seed << 13;
+        header->seed ^= header->seed >> 17;
+        header->seed ^= header->seed << 5;
+
+        __atomic_store_n( &sh->nodes[node].left, left, __ATOMIC_RELAXED );
+        __atomic_store_n( &sh->nodes[node].right, right, __ATOMIC_RELAXED );
+        __atomic_store_n( &sh->nodes[node].lchild, 0, __ATOMIC_RELAXED );
+        __atomic_store_n( &sh->nodes[node].rchild, 0, __ATOMIC_RELAXED );
+        sh->nodes[node].priority = header->seed;
+        header->count++;
+
+        return node;
+}
+
+static uint32_t
+interval_shared_floor( const interval_shared_t* sh, int value )
+{
+        /*
+                The writer's floor search ( nothing changes under it ).
+         */
+
+        uint32_t        node = sh->header->root;
+        uint32_t        floor = 0;
+
+        while ( node )
+        {
+                if ( sh->nodes[node].left <= value )
+                {
+                        floor = node;
+                        node = sh->nodes[node].rchild;
+                }
+                else
+                {
+                        node = sh->nodes[node].lchild;
+                }
+        }
+
+        return floor;
+}
+
+static void
+interval_shared_write_begin( interval_shared_t* sh )
+{
+        uint32_t        sequence = atomic_load_explicit( &sh->header->sequence, memory_order_relaxed );
+
+        atomic_store_explicit( &sh->header->sequence, sequence + 1, memory_order_relaxed );
+        atomic_thread_fence( memory_order_release );
+}
+
+static void
+interval_shared_write_end( interval_shared_t* sh )
+{
+        uint32_t        sequence = atomic_load_explicit( &sh->header->sequence, memory_order_relaxed );
+
+        atomic_store_explicit( &sh->header->sequence, sequence + 1, memory_order_release );
+}
+
+int
+interval_shared_add( interval_shared_t* sh, int newLeft, int newRight )
+{
+        /*
+                Same steps as interval_set_concurrent_add, in place. Only the
+                writer may call this. Returns -1 ( and leaves the set alone )
+                if the segment has no room for another interval.
+         */
+
+        interval_shared_header_t*       header = sh->header;
+        uint32_t                        floor;
+        uint32_t                        less;
+        uint32_t                        rest;
+        uint32_t                        covered;
+
+        if ( newLeft >= newRight )
+        {
+                return 0;
+        }
+
+        floor = interval_shared_floor( sh, newLeft );
+
+        if ( floor && newLeft <= sh->nodes[floor].right )
+        {
+                newLeft = sh->nodes[floor].left;
+        }
+
+        floor = interval_shared_floor( sh, newRight );
+
+        if ( floor && newRight < sh->nodes[floor].right )
+        {
+                newRight = sh->nodes[floor].right;
+        }
+
+        /*
+                The covered nodes are freed before the new one is taken, so 
+                a full segment only matters if nothing is covered.
+         */
+
+        if ( !header->free && header->used == header->capacity && !( floor && sh->nodes[floor].left >= newLeft ) )
+        {
+                errno = ENOSPC;
+                return -1;
+        }
+
+        interval_shared_write_begin( sh );
+
+        interval_shared_split( sh->nodes, header->root, newLeft, &less, &rest );
+        interval_shared_split( sh->nodes, rest, newRight, &covered, &rest );
+        interval_shared_drop( sh, covered );
+
+        less = interval_shared_merge( sh->nodes, less, interval_shared_create_node( sh, newLeft, newRight ) );
+        __atomic_store_n( &header->root, interval_shared_merge( sh->nodes, less, rest ), __ATOMIC_RELAXED );
+
+        interval_shared_write_end( sh );
+
+        return 0;
+}
+
+int
+interval_shared_remove( interval_shared_t* sh, int newLeft, int newRight )
+{
+        /*
+                Same steps as interval_set_concurrent_remove, in place. Only
+                the writer may call this. Splitting an interval in two needs
+                a node, so this can fail with -1 like interval_shared_add.
+         */
+
+        interval_shared_header_t*       header = sh->header;
+        uint32_t                        first;
+        uint32_t                        last;
+        uint32_t                        less;
+        uint32_t                        rest;
+        uint32_t                        covered;
+        int                             start = newLeft;
+        int                             leftPiece = 0;
+        int                             rightPiece = 0;
+        int                             keepLeft = 0;
+        int                             keepRight = 0;
+
+        if ( newLeft >= newRight )
+        {
+                return 0;
+        }
+
+        first = interval_shared_floor( sh, newLeft );
+        last = interval_shared_floor( sh, newRight - 1 );
+
+        if ( first && sh->nodes[first].right > newLeft )
+        {
+                start = sh->nodes[first].left;
+                keepLeft = sh->nodes[first].left < newLeft;
+                leftPiece = sh->nodes[first].left;
+        }
+
+        if ( last && sh->nodes[last].right > newRight )
+        {
+                keepRight = 1;
+                rightPiece = sh->nodes[last].right;
+        }
+
+        if ( keepLeft && keepRight && first == last && !header->free && header->used == header->capacity )
+        {
+                errno = ENOSPC;
+                return -1;
+        }
+
+        interval_shared_write_begin( sh );
+
+        interval_shared_split( sh->nodes, header->root, start, &less, &rest );
+        interval_shared_split( sh->nodes, rest, newRight, &covered, &rest );
+        interval_shared_drop( sh, covered );
+
+        if ( keepLeft )
+        {
+                less = interval_shared_merge( sh->nodes, less, interval_shared_create_node( sh, leftPiece, newLeft ) );
+        }
+
+        if ( keepRight )
+        {
+                rest = interval_shared_merge( sh->nodes, interval_shared_create_node( sh, newRight, rightPiece ), rest );
+        }
+
+        __atomic_store_n( &header->root, interval_shared_merge( sh->nodes, less, rest ), __ATOMIC_RELAXED );
+
+        interval_shared_write_end( sh );
+
+        return 0;
+}
+
+static uint32_t
+interval_shared_read_begin( const interval_shared_t* sh )
+{
+        /*
+                Waits out a write in progress and returns the sequence number
+                to check the read against.
+         */
+
+        uint32_t        sequence;
+
+        while ( ( sequence = atomic_load_explicit( &sh->header->sequence, memory_order_acquire ) ) & 1 )
+        {
+                sched_yield();
+        }
+
+        return sequence;
+}
+
+static int
+interval_shared_read_valid( const interval_shared_t* sh, uint32_t sequence )
+{
+        atomic_thread_fence( memory_order_acquire );
+
+        return atomic_load_explicit( &sh->header->sequence, memory_order_relaxed ) == sequence;
+}
+
+static int
+interval_shared_node_load( const interval_shared_t* sh, uint32_t node, int* left, int* right, uint32_t* lchild, uint32_t* rchild )
+{
+        /*
+                Reads a node while the writer may be changing it, returning 0
+                for an index that is out of range ( which only a torn read 
+                can produce ).
+         */
+
+        const interval_shared_node_t*   n;
+
+        if ( node > sh->header->capacity )
+        {
+                return 0;
+        }
+
+        n = &sh->nodes[node];
+
+        *left = __atomic_load_n( &n->left, __ATOMIC_RELAXED );
+        *right = __atomic_load_n( &n->right, __ATOMIC_RELAXED );
+        *lchild = __atomic_load_n( &n->lchild, __ATOMIC_RELAXED );
+        *rchild = __atomic_load_n( &n->rchild, __ATOMIC_RELAXED );
+
+        return 1;
+}
+
+static int
+interval_shared_find( const interval_shared_t* sh, uint32_t sequence, int value, int* left, int* right )
+{
+        /*
+                A reader's floor search: finds the interval with the greatest
+                left value at or before 'value' and returns 1, or 0 if there
+                is none, or -1 if a write got in the way. A torn read can 
+                send us round in circles, so the sequence is checked every 
+                so often on the way down.
+         */
+
+        uint32_t        node = __atomic_load_n( &sh->header->root, __ATOMIC_RELAXED );
+        int             found = 0;
+        int             l;
+        int             r;
+        uint32_t        lchild;
+        uint32_t        rchild;
+
+        for ( unsigned int steps = 1; node; steps++ )
+        {
+                if ( !interval_shared_node_load( sh, node, &l, &r, &lchild, &rchild ) )
+                {
+                        return -1;
+                }
+
+                if ( l <= value )
+                {
+                        *left = l;
+                        *right = r;
+                        found = 1;
+                        node = rchild;
+                }
+                else
+                {
+                        node = lchild;
+                }
+
+                if ( steps % 64 == 0 && !interval_shared_read_valid( sh, sequence ) )
+                {
+                        return -1;
+                }
+        }
+
+        return found;
+}
+
+int
+interval_shared_contains( const interval_shared_t* sh, int value )
+{
+        int     left = 0;
+        int     right = 0;
+        int     found;
+
+        while ( 1 )
+        {
+                uint32_t        sequence = interval_shared_read_begin( sh );
+
+                found = interval_shared_find( sh, sequence, value, &left, &right );
+
+                if ( found >= 0 && interval_shared_read_valid( sh, sequence ) )
+                {
+                        return found && value < right;
+                }
+        }
+}
+
+int
+interval_shared_overlaps( const interval_shared_t* sh, int newLeft, int newRight )
+{
+        int     left = 0;
+        int     right = 0;
+        int     found;
+
+        if ( newLeft >= newRight )
+        {
+                return 0;
+        }
+
+        while ( 1 )
+        {
+                uint32_t        sequence = interval_shared_read_begin( sh );
+
+                found = interval_shared_find( sh, sequence, newRight - 1, &left, &right );
+
+                if ( found >= 0 && interval_shared_read_valid( sh, sequence ) )
+                {
+                        return found && newLeft < right;
+                }
+        }
+}
+
+static int
+interval_shared_format( const interval_shared_t* sh, uint32_t sequence, interval_text_t* text, uint32_t* stack, uint32_t capacity )
+{
+        /*
+                Formats the intervals in order, walking the treap with an 
+                explicit stack of 'capacity' entries. No path through a
+                consistent treap is longer than its node count, so only a
+                torn read can fill the stack. Returns 0 if a write got in the
+                way.
+         */
+
+        size_t          depth = 0;
+        uint32_t        node = __atomic_load_n( &sh->header->root, __ATOMIC_RELAXED );
+        size_t          visited = 0;
+        int             l = 0;
+        int             r = 0;
+        uint32_t        lchild = 0;
+        uint32_t        rchild = 0;
+
+        interval_text_append( text, "{", 1 );
+
+        while ( node || depth )
+        {
+                while ( node )
+                {
+                        if ( depth == capacity || !interval_shared_node_load( sh, node, &l, &r, &lchild, &rchild ) )
+                        {
+                                return 0;
+                        }
+
+                        stack[depth++] = node;
+                        node = lchild;
+                }
+
+                node = stack[--depth];
+                interval_shared_node_load( sh, node, &l, &r, &lchild, &rchild );
+                interval_text_interval( text, l, r );
+                node = rchild;
+
+                if ( ++visited % 64 == 0 && !interval_shared_read_valid( sh, sequence ) )
+                {
+                        return 0;
+                }
+        }
+
+        interval_text_append( text, "}\n", 2 );
+
+        return 1;
+}
+
+void
+interval_shared_print( const interval_shared_t* sh )
+{
+        /*
+                Prints the set like interval_set_print. The text is only 
+                written out once the walk is known to have seen a single 
+                consistent version. The walk's stack is sized from the
+                segment's capacity, so any treap fits.
+         */
+
+        interval_text_t         text = { 0 };
+        uint32_t                capacity = sh->header->capacity;
+        uint32_t*               stack = ( uint32_t* ) malloc( ( ( size_t ) capacity + 1 ) * sizeof( uint32_t ) );
+
+        while ( 1 )
+        {
+                uint32_t        sequence = interval_shared_read_begin( sh );
+
+                if ( interval_shared_format( sh, sequence, &text, stack, capacity ) && interval_shared_read_valid( sh, sequence ) )
+                {
+                        break;
+                }
+
+                text.length = 0;
+        }
+
+        free( stack );
+        interval_text_flush( &text, stdout );
+}
+
+/*
+        Benchmark workloads, each generating a stream of adds and removes 
+        over a key space of a given size.
+ */
+
+typedef struct INTERVAL_BENCH interval_bench_t;
+
+typedef void ( *interval_bench_fn )( interval_bench_t* b, uint64_t r, interval_op_t* op );
+
+struct INTERVAL_BENCH
+{
+        interval_bench_fn       generate;
+        uint64_t                rng;
+        int                     keyspace;
+        int                     cursor;
+        long                    step;
+        double*                 zipf;
+};
+
+static uint64_t
+interval_bench_random( interval_bench_t* b )
+{
+        b->rng ^= b->rng << 13;
+        b->rng ^= b->rng >> 7;
+        b->rng ^= b->rng << 17;
+
+        return b->rng;
+}
+
+static int
+interval_bench_key( interval_bench_t* b )
+{
+        return ( int ) ( interval_bench_random( b ) % ( uint64_t ) b->keyspace );
+}
+
+static int
+interval_bench_length( uint64_t r )
+{
+        return 1 + ( int ) ( ( r >> 8 ) % 64 );
+}
+
+static void
+interval_bench_uniform( interval_bench_t* b, uint64_t r, interval_op_t* op )
+{
+        /*
+                Random adds and removes ( 2 to 1 ) anywhere.
+         */
+
+        op->kind = ( r % 3 ) ? INTERVAL_OP_ADD : INTERVAL_OP_REMOVE;
+        op->left = interval_bench_key( b );
+        op->right = op->left + interval_bench_length( r );
+}
+
+static void
+interval_bench_append( interval_bench_t* b, uint64_t r, interval_op_t* op )
+{
+        /*
+                Mostly adds just past the previous one, with the odd remove a
+                little behind it.
+         */
+
+        b->cursor += 1 + ( int ) ( ( r >> 20 ) % 128 );
+
+        if ( b->cursor >= b->keyspace - 64 )
+        {
+                b->cursor = 0;
+        }
+
+        op->kind = ( r % 10 ) ? INTERVAL_OP_ADD : INTERVAL_OP_REMOVE;
+        op->left = b->cursor - ( op->kind == INTERVAL_OP_REMOVE ? ( int ) ( ( r >> 40 ) % 1024 ) : 0 );
+        op->right = op->left + interval_bench_length( r );
+}
+
+static void
+interval_bench_fragment( interval_bench_t* b, uint64_t r, interval_op_t* op )
+{
+        /*
+                One interval covering everything, split over and over by 
+                small removes.
+         */
+
+        if ( b->step == 1 )
+        {
+                op->kind = INTERVAL_OP_ADD;
+                op->left = 0;
+                op->right = b->keyspace;
+
+                return;
+        }
+
+        op->kind = ( r % 8 ) ? INTERVAL_OP_REMOVE : INTERVAL_OP_ADD;
+        op->left = interval_bench_key( b );
+        op->right = op->left + 1 + ( int ) ( ( r >> 8 ) % 4 );
+}
+
+static void
+interval_bench_sweep( interval_bench_t* b, uint64_t r, interval_op_t* op )
+{
+        /*
+                Small adds and removes, with a wide add every so often that 
+                merges everything under it.
+         */
+
+        op->kind = ( r % 2 ) ? INTERVAL_OP_ADD : INTERVAL_OP_REMOVE;
+        op->left = interval_bench_key( b );
+        op->right = op->left + interval_bench_length( r );
+
+        if ( b->step % 1000 == 0 )
+        {
+                op->kind = INTERVAL_OP_ADD;
+                op->right = op->left + b->keyspace / 16;
+        }
+}
+
+static void
+interval_bench_window( interval_bench_t* b, uint64_t r, interval_op_t* op )
+{
+        /*
+                Adds and removes within a 4096 wide window that creeps 
+                forward, wrapping around at the end.
+         */
+
+        if ( b->step % 4 == 0 && ++b->cursor >= b->keyspace - 4096 - 64 )
+        {
+                b->cursor = 0;
+        }
+
+        op->kind = ( r % 2 ) ? INTERVAL_OP_ADD : INTERVAL_OP_REMOVE;
+        op->left = b->cursor + ( int ) ( ( r >> 20 ) % 4096 );
+        op->right = op->left + 1 + ( int ) ( ( r >> 8 ) % 16 );
+}
+
+static void
+interval_bench_zipf( interval_bench_t* b, uint64_t r, interval_op_t* op )
+{
+        /*
+                Adds and removes concentrated on a few hot regions: the key 
+                space is cut into regions picked with a Zipf ( s = 1 ) 
+                distribution.
+         */
+
+        double  u = ( double ) ( r >> 11 ) / ( double ) ( 1ull << 53 );
+        int     lo = 0;
+        int     hi = INTERVAL_BENCH_ZIPF_REGIONS - 1;
+        int     width = b->keyspace / INTERVAL_BENCH_ZIPF_REGIONS;
+
+        while ( lo < hi )
+        {
+                int     mid = ( lo + hi ) / 2;
+
+                if ( b->zipf[mid] < u )
+                {
+                        lo = mid + 1;
+                }
+                else
+                {
+                        hi = mid;
+                }
+        }
+
+        /*
+                Scatter the ranks over the key space, so that the hot regions
+                are not all next to each other.
+         */
+
+        lo = ( int ) ( ( ( uint64_t ) lo * 2654435761u ) % INTERVAL_BENCH_ZIPF_REGIONS );
+
+        op->kind = ( interval_bench_random( b ) % 2 ) ? INTERVAL_OP_ADD : INTERVAL_OP_REMOVE;
+        op->left = lo * width + ( int ) ( interval_bench_random( b ) % ( uint64_t ) ( width ? width : 1 ) );
+        op->right = op->left + interval_bench_length( r );
+}
+
+static const struct
+{
+        const char*             name;
+        interval_bench_fn       generate;
+} interval_bench_workloads[] =
+{
+        { "uniform",    interval_bench_uniform },
+        { "append",     interval_bench_append },
+        { "fragment",   interval_bench_fragment },
+        { "sweep",      interval_bench_sweep },
+        { "window",     interval_bench_window },
+        { "zipf",       interval_bench_zipf },
+};
+
+#define INTERVAL_BENCH_WORKLOADS ( sizeof( interval_bench_workloads ) / sizeof( interval_bench_workloads[0] ) )
+
+static interval_bench_fn
+interval_bench_lookup( const char* name )
+{
+        for ( size_t i = 0; i < INTERVAL_BENCH_WORKLOADS; i++ )
+        {
+                if ( strcmp( interval_bench_workloads[i].name, name ) == 0 )
+                {
+                        return interval_bench_workloads[i].generate;
+                }
+        }
+
+        return NULL;
+}
+
+static void
+interval_bench_next( interval_bench_t* b, interval_op_t* op )
+{
+        b->step++;
+        b->generate( b, interval_bench_random( b ), op );
+}
 
-                        This is the opposite case of the previous else-if
-                        condition.
+static double
+interval_bench_percentile( const unsigned long* histogram, unsigned long total, double fraction )
+{
+        /*
+                Latency histogram buckets are log-linear: the bucket of a 
+                value is its highest set bit followed by the next 
+                INTERVAL_BENCH_SUB_BITS bits. Returns the lower bound of the
+                bucket holding the given fraction of the samples.
+         */
 
-                        We can update the node 'newLeft' belongs in and delete all 
-                        nodes after it.
-                 */
+        unsigned long   rank = ( unsigned long ) ( fraction * total );
+        unsigned long   seen = 0;
 
-                interval_t*     temp = lNode->next;
+        if ( rank < fraction * total )
+        {
+                rank++;
+        }
 
-                lNode->right = newRight;
-                is->tail = lNode;
+        for ( int bucket = 0; bucket < INTERVAL_BENCH_BUCKETS; bucket++ )
+        {
+                seen += histogram[bucket];
 
-                while ( temp )
+                if ( seen >= rank && seen )
                 {
-                        temp = temp->next;
-                        free( temp->prev );
-                }
+                        int     msb = bucket >> INTERVAL_BENCH_SUB_BITS;
+                        int     sub = bucket & ( ( 1 << INTERVAL_BENCH_SUB_BITS ) - 1 );
 
-                lNode->next = NULL;
+                        if ( msb < INTERVAL_BENCH_SUB_BITS )
+                        {
+                                return sub;
+                        }
+
+                        return ( double ) ( ( ( uint64_t ) ( ( 1 << INTERVAL_BENCH_SUB_BITS ) | sub ) ) << ( msb - INTERVAL_BENCH_SUB_BITS ) );
+                }
         }
-        else if ( !lNode && !rNode )
+
+        return 0;
+}
+
+static int
+interval_bench_bucket( uint64_t nanoseconds )
+{
+        int     msb = 63 - __builtin_clzll( nanoseconds | 1 );
+
+        if ( msb < INTERVAL_BENCH_SUB_BITS )
         {
-                /*
-                        If neither lNode or rNode are defined at this point,
-                        then there are 4 subcases we need newRight check newRight add the
-                        interval [newLeft, newRight).
-                 */
+                return ( int ) nanoseconds;
+        }
 
-                if ( newLeft < is->head->left && newRight > is->tail->right )
-                {
-                        /*
-                                Case 1: both 'newLeft' and 'newRight' represent a range 
-                                that begins before any range in the set and ends after
-                                any range in the set.
+        return ( msb << INTERVAL_BENCH_SUB_BITS ) | ( int ) ( ( nanoseconds >> ( msb - INTERVAL_BENCH_SUB_BITS ) ) & ( ( 1 << INTERVAL_BENCH_SUB_BITS ) - 1 ) );
+}
 
-                                Since this consumes the entire existing set, we can just 
-                                replace the set that was passed as an argument with a 
-                                new one solely containing the range [newLeft, newRight).
-                         */
+static uint64_t
+interval_bench_now( void )
+{
+        struct timespec         ts;
 
-                        interval_set_free( is );
+        clock_gettime( CLOCK_MONOTONIC, &ts );
 
-                        interval_set_t*         new_is = ( interval_set_t * ) calloc( 1, sizeof( interval_set_t ) );
+        return ( uint64_t ) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
 
-                        interval_set_add(new_is, newLeft, newRight, SHOULD_NOT_PRINT);
+int
+interval_set_bench( const char* workload, int backend, long ops, int keyspace, unsigned long seed, size_t defer )
+{
+        /*
+                Runs 'ops' operations of the named workload against a fresh set
+                and prints one JSON line with the throughput, latency 
+                percentiles, peak RSS and final interval count. Returns -1 for
+                an unknown workload. With 'defer', the set runs in deferred
+                mode with a queue of that many operations. The key space is
+                clamped to [INTERVAL_BENCH_ZIPF_REGIONS, 
+                INTERVAL_BENCH_MAX_KEYSPACE].
+         */
 
-                        is = new_is;
-                }
-                else if ( newLeft > is->head->left && newRight < is->tail->right )
-                {
-                        /*
-                                Case 2: both 'newLeft' and 'newRight' represent a range in
-                                between existing intervals in the set.
-
-                                This could be either a case where both 'newLeft' and
-                                'newRight' are between any interval in the set or the case
-                                where 'newLeft' and 'newRight' is a range that covers multiple
-                                nodes in the set, in which case those nodes would get deleted
-                                and a new node inserted in the set.
-                         */
+        interval_bench_t        b = { 0 };
+        unsigned long*          histogram;
+        interval_set_t*         is;
+        interval_op_t           op;
+        interval_iter_t         it;
+        struct rusage           usage;
+        uint64_t                start;
+        uint64_t                elapsed;
+        size_t                  intervals = 0;
+        int                     left;
+        int                     right;
+        double                  sum = 0;
 
-                        interval_t*             p = is->head;
-                        interval_t*             nearestLeftNode = NULL;
-                        interval_t*             nearestRightNode = NULL;
+        b.generate = interval_bench_lookup( workload );
 
-                        while ( p )
-                        {
-                                if ( newLeft < p->left && !nearestLeftNode )
-                                {
-                                        nearestLeftNode = p;
-                                }
-                                if ( newRight < p->left && !nearestRightNode )
-                                {
-                                        nearestRightNode = p;
-                                }
+        if ( !b.generate )
+        {
+                return -1;
+        }
 
-                                if ( nearestLeftNode && nearestRightNode )
-                                {
-                                        break;
-                                }
+        histogram = ( unsigned long* ) calloc( INTERVAL_BENCH_BUCKETS, sizeof( unsigned long ) );
+        is = interval_set_create( backend );
 
-                                p = p->next;
-                        }
+        b.rng = seed ? seed : 88172645463325252ull;
+        b.keyspace = keyspace > INTERVAL_BENCH_ZIPF_REGIONS ? keyspace : INTERVAL_BENCH_ZIPF_REGIONS;
+        b.keyspace = b.keyspace < INTERVAL_BENCH_MAX_KEYSPACE ? b.keyspace : INTERVAL_BENCH_MAX_KEYSPACE;
+        b.zipf = ( double* ) malloc( INTERVAL_BENCH_ZIPF_REGIONS * sizeof( double ) );
 
-                        /*
-                                First insert the newNode before the nearestLeftNode.
-                         */
+        for ( int i = 0; i < INTERVAL_BENCH_ZIPF_REGIONS; i++ )
+        {
+                sum += 1.0 / ( i + 1 );
+                b.zipf[i] = sum;
+        }
 
-                        interval_t*             newNode = ( interval_t* ) calloc( 1, sizeof( interval_t ) );
+        for ( int i = 0; i < INTERVAL_BENCH_ZIPF_REGIONS; i++ )
+        {
+                b.zipf[i] /= sum;
+        }
 
-                        newNode->left = newLeft;
-                        newNode->right = newRight;
+        if ( defer )
+        {
+                interval_set_defer( is, defer );
+        }
 
-                        nearestLeftNode->prev->next = newNode;
+        start = interval_bench_now();
 
-                        /*
-                                newNode should point to nearestRightNode, since we will
-                                free all nodes from nearestLeftNode ( inclusively ) to 
-                                nearestRightNode ( exclusively ).
-                         */
+        for ( long i = 0; i < ops; i++ )
+        {
+                uint64_t        before;
 
-                        newNode->next = nearestRightNode;
-                        
-                        while ( nearestLeftNode != nearestRightNode )
-                        {
-                                nearestLeftNode = nearestLeftNode->next;
-                                free( nearestLeftNode->prev );
-                        }
-                }
-                else if ( newLeft < is->head->left && newRight > is->head->left )
-                {
-                        /*
-                                Case 3: 'newLeft' and 'newRight' represent a range that starts 
-                                less than any existing range and ends somewhere between existing 
-                                intervals in the set.
-                         */
+                interval_bench_next( &b, &op );
 
-                        interval_t*             temp = is->head;
+                before = interval_bench_now();
 
-                        rNode->right = newRight;
-                        rNode->left = newLeft;
-                        
-                        while ( temp != rNode )
-                        {
-                                temp = temp->next;
-                                free( temp->prev );
-                        }
-                        
-                        is->head = rNode;
+                if ( op.kind == INTERVAL_OP_ADD )
+                {
+                        interval_set_add( is, op.left, op.right, SHOULD_NOT_PRINT );
                 }
-                else if ( newLeft > is->head->left && newRight > is->tail->right )
+                else
                 {
-                        /*
-                                Case 4: 'newLeft' and 'newRight' represent a range that 
-                                starts between existing ranges in the set and ends 
-                                greater than any existing range.
-                         */
+                        interval_set_remove( is, op.left, op.right, SHOULD_NOT_PRINT );
+                }
 
-                        interval_t*             temp = lNode->next;
+                histogram[interval_bench_bucket( interval_bench_now() - before )]++;
+        }
 
-                        lNode->right = newRight;
-                        lNode->left = newLeft;
+        interval_set_flush( is );
 
-                        is->tail = lNode;
+        elapsed = interval_bench_now() - start;
 
-                        while ( temp )
-                        {
-                                temp = temp->next;
-                                free( temp->prev );
-                        }
+        interval_iter_begin( &it, is );
 
-                        lNode->next = NULL;
-                }
-        }
-        
-        if ( should_print )
+        while ( interval_iter_next( &it, &left, &right ) )
         {
-                interval_set_print( is );
+                intervals++;
         }
+
+        getrusage( RUSAGE_SELF, &usage );
+
+        printf( "{\"workload\": \"%s\", \"backend\": \"%s\", \"ops\": %ld, \"seconds\": %.6f, "
+                        "\"ops_per_sec\": %.0f, \"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f, "
+                        "\"peak_rss_kb\": %ld, \"intervals\": %zu}\n",
+                        workload,
+                        backend == INTERVAL_BACKEND_ARRAY ? "array" : backend == INTERVAL_BACKEND_BLOCK ? "block" : backend == INTERVAL_BACKEND_HYBRID ? "hybrid" : "list",
+                        ops,
+                        elapsed / 1e9,
+                        elapsed ? ops / ( elapsed / 1e9 ) : 0,
+                        interval_bench_percentile( histogram, ops, 0.50 ),
+                        interval_bench_percentile( histogram, ops, 0.99 ),
+                        interval_bench_percentile( histogram, ops, 0.999 ),
+                        usage.ru_maxrss,
+                        intervals );
+
+        interval_set_stats_print( is, stderr );
+
+        free( b.zipf );
+        free( histogram );
+        interval_set_free( is );
+
+        return 0;
 }
 
-void
-interval_set_remove( interval_set_t* is,
-                int newLeft,
-                int newRight,
-                int should_print )
+static void
+interval_feed_print( const interval_change_t* change, void* context )
 {
-        if ( !is->head || newLeft >= newRight )
+        ( void ) context;
+
+        if ( change->kind == INTERVAL_CHANGE_RESIZE )
         {
-                return;
+                printf( "~[%d, %d) -> [%d, %d)\n", change->oldLeft, change->oldRight, change->left, change->right );
         }
-        
-        interval_t*             p = is->head;
-        interval_t*             lNode = NULL;
-        interval_t*             rNode = NULL;
+        else
+        {
+                printf( "%c[%d, %d)\n", change->kind, change->left, change->right );
+        }
+}
 
-        /*
-                In the following while loop, we look for the interval nodes
-                that newLeft and newRight are within the range of ( pointed
-                to by lNode and rNode respectively). The value of the 
-                pointers is then used to determine how the range 
-                [newLeft, newRight) can be excluded from the interval set.
-         */
+int
+main( int argc, char** argv )
+{
 
-        while ( p )
+        size_t                  bufSize = 1024;
+        char*                   buf;
+        int                     backend = INTERVAL_BACKEND_LIST;
+        const char*             input = NULL;
+        int                     binary = 0;
+        int                     should_print = SHOULD_NOT_PRINT;
+        int                     changes = 0;
+        const char*             workload = NULL;
+        long                    benchOps = 1000000;
+        int                     keyspace = 1 << 24;
+        unsigned long           seed = 0;
+        size_t                  defer = 0;
+        const char*             state = NULL;
+        char*                   stateLog = NULL;
+        interval_log_t*         log = NULL;
+        interval_set_t*         is;
+
+        for ( int i = 1; i < argc; i++ )
         {
-                if ( p->left <= newLeft && newLeft <= p->right )
+                if ( strcmp( argv[i], "-a" ) == 0 )
                 {
-                        lNode = p;
+                        backend = INTERVAL_BACKEND_ARRAY;
                 }
-
-                if ( p->left <= newRight && newRight <= p->right )
+                else if ( strcmp( argv[i], "-z" ) == 0 )
                 {
-                        rNode = p;
+                        backend = INTERVAL_BACKEND_BLOCK;
                 }
-
-                p = p->next;
-        }
-
-        if ( ( lNode && rNode ) && ( lNode != rNode ) )
-        {
-                /*
-                        When lNode and rNode are defined and are not equal to 
-                        eachother, this means 'newLeft' and 'newRight' are values 
-                        that exist in two different intervals in the set.
-
-                        We can then update those two nodes accordingly and
-                        delete all existing nodes inbetween.
-                 */
-
-                interval_t*             limit;
-                interval_t*             temp = lNode->next;
-                
-                lNode->right = newLeft;
-
-                if ( rNode->right == newRight )
+                else if ( strcmp( argv[i], "-y" ) == 0 )
                 {
-                        limit = rNode->next;
+                        backend = INTERVAL_BACKEND_HYBRID;
                 }
-                else
+                else if ( strcmp( argv[i], "-f" ) == 0 && i + 1 < argc )
                 {
-                        rNode->left = newRight;
-                        limit = rNode;
+                        input = argv[++i];
                 }
-
-                lNode->next = limit;
-                
-                while ( temp != limit )
+                else if ( strcmp( argv[i], "-b" ) == 0 )
+                {
+                        binary = 1;
+                }
+                else if ( strcmp( argv[i], "-p" ) == 0 )
                 {
-                        temp = temp->next;
-                        free( temp->prev );
+                        should_print = SHOULD_PRINT;
                 }
-                
-                if ( !lNode->next )
+                else if ( strcmp( argv[i], "-c" ) == 0 )
                 {
-                        is->tail = lNode;
+                        changes = 1;
+                }
+                else if ( strcmp( argv[i], "-B" ) == 0 && i + 1 < argc )
+                {
+                        workload = argv[++i];
+                }
+                else if ( strcmp( argv[i], "-n" ) == 0 && i + 1 < argc )
+                {
+                        benchOps = atol( argv[++i] );
+                }
+                else if ( strcmp( argv[i], "-k" ) == 0 && i + 1 < argc )
+                {
+                        keyspace = atoi( argv[++i] );
+                }
+                else if ( strcmp( argv[i], "-s" ) == 0 && i + 1 < argc )
+                {
+                        seed = strtoul( argv[++i], NULL, 10 );
+                }
+                else if ( strcmp( argv[i], "-d" ) == 0 && i + 1 < argc )
+                {
+                        defer = strtoul( argv[++i], NULL, 10 );
+                }
+                else if ( strcmp( argv[i], "-o" ) == 0 && i + 1 < argc )
+                {
+                        state = argv[++i];
+                }
+                else
+                {
+                        fprintf( stderr, "usage: %s [-a|-z|-y] [-c] [-d queue] [-o state] [-f file|- [-b] [-p]] [-B workload [-n ops] [-k keyspace] [-s seed]]\n", argv[0] );
+                        return 1;
                 }
         }
-        else if ( !lNode && rNode )
-        {
-                /*
-                        When lNode is not defined and rNode is, this means there
-                        are 2 possible cases:
-
-                        - Either 'newLeft' exists below all the intervals in the 
-                        set and 'newRight' exists WITHIN an interval in the set.
-
-                        - Or 'newleft' exists in between some intervals in the
-                        set and 'newRight' exists WITHIN an interval in the set.
 
-                        For the first case, we can update the node 'newRight' 
-                        exists in accordingly and remove all nodes before it.
-
-                        For the second case, this is an invalid operation, since
-                        we can't be certain would the new left value for any
-                        interval would be. We can do nothing and exit gracefully 
-                        in this case.
-                 */
-
-                if ( newLeft < is->head->left )
+        if ( workload )
+        {
+                if ( keyspace > INTERVAL_BENCH_MAX_KEYSPACE )
                 {
-                        interval_t*     temp = is->head;
+                        fprintf( stderr, "key space %d too large ( at most %d )\n", keyspace, INTERVAL_BENCH_MAX_KEYSPACE );
+                        return 1;
+                }
 
-                        rNode->left = newRight;
+                if ( interval_set_bench( workload, backend, benchOps, keyspace, seed, defer ) < 0 )
+                {
+                        fprintf( stderr, "unknown workload '%s' (", workload );
 
-                        while ( temp != rNode )
+                        for ( size_t w = 0; w < INTERVAL_BENCH_WORKLOADS; w++ )
                         {
-                                temp = temp->next;
-                                free( temp->prev );
+                                fprintf( stderr, "%s %s", w ? "," : "", interval_bench_workloads[w].name );
                         }
-                        
-                        is->head = rNode;
+
+                        fprintf( stderr, " )\n" );
+                        return 1;
                 }
+
+                return 0;
         }
-        else if ( lNode && !rNode )
+
+        if ( state )
         {
                 /*
-                        This is the same as the previous else-if case except
-                        reversed. There are still 2 cases:
-
-                        - Either 'newLeft' exists below all the intervals in the 
-                        set and 'newRight' exists WITHIN an interval in the set.
-
-                        - Or 'newleft' exists in between some intervals in the
-                        set and 'newRight' exists WITHIN an interval in the set.
-
-                        Again for the first case, we can update the node 
-                        'newLeft' exists in accordingly and remove all nodes 
-                        following it.
-
-                        For the second case, this would also be a no-op and can
-                        exit gracefully.
+                        Restore the set from the 'state' snapshot and the 
+                        operations logged since then in 'state.log', and log
+                        every operation from here on.
                  */
 
-                if ( newRight > is->tail->right )
-                {
-                        interval_t*     temp = lNode->next;
+                stateLog = ( char* ) malloc( strlen( state ) + 5 );
+                sprintf( stateLog, "%s.log", state );
 
-                        lNode->right = newLeft;
-                        is->tail = lNode;
-                        
-                        while ( temp )
-                        {
-                                temp = temp->next;
-                                free( temp->prev );
-                        }
+                is = interval_set_load( backend, state, stateLog );
+                log = is ? interval_log_open( stateLog ) : NULL;
 
-                        lNode->next = NULL;
+                if ( !log )
+                {
+                        perror( state );
+                        return 1;
                 }
         }
-        else if ( !lNode && !rNode )
+        else
         {
-                /*
-                        If neither lNode or rNode is defined, then the range 
-                        [newLeft, newRight) simply does not exist anywhere in the 
-                        interval set and no work is necessary with one exception.
+                is = interval_set_create( backend );
+        }
 
-                        The only case we need to check here is if the range 
-                        [newLeft, newRight) covers the entire range. In which 
-                        case, the entire set needs to be effectively deleted. 
+        if ( defer )
+        {
+                interval_set_defer( is, defer );
+        }
 
-                        Therefore, we can just free the interval set passed as
-                        an argument and replace it with a newly allocated one.
+        if ( changes )
+        {
+                /*
+                        Print what each operation changed, instead of the 
+                        whole set after each operation.
                  */
 
-                if ( newLeft < is->head->left && newRight > is->tail->right )
-                {
-                        interval_set_free(is);
-
-                        interval_set_t*         new_is = ( interval_set_t* ) calloc( 1, sizeof( interval_set_t ) );
-                        
-                        is = new_is;
-                }
+                interval_set_feed_callback( is, interval_feed_print, NULL );
         }
-        else if ( lNode == rNode )
+
+        if ( input )
         {
                 /*
-                        If lNode and rNode are defined (which was checked by
-                        a previous if condition) and they are identical, then
-                        this means that the interval we are removing is inside 
-                        of an interval in the set. 
-
-                        In this case, there are four possible subcases that 
-                        need we need to check for.
+                        Non-interactive mode: replay the whole input, then 
+                        print the resulting set once.
                  */
 
-                if ( lNode->left == newLeft && rNode->right == newRight )
-                {
-                        /*
-                                Case 1: [newLeft, newRight) covers the entire range of the 
-                                interval node, in which case we just need to delete it.
-                         */
-
-                        interval_t*     next = lNode->next;
-                        interval_t*     prev = lNode->prev;
-                        
-                        if (prev)
-                        {
-                                prev->next = next;
-                        }
-                        else
-                        {
-                                is->head = next;
-                        }
-                        
-                        if (next)
-                        {
-                                next->prev = prev;
-                        }
-                        else
-                        {
-                                is->tail = prev;
-                        }
+                int     status = interval_set_replay( is, input, binary, should_print );
 
-                        free(lNode);
-                }
-                else if ( lNode->left == newLeft && newRight <= lNode->right )
+                if ( status < 0 )
                 {
-                        /*
-                                Case 2: [newLeft, newRight) starts at the node's left 
-                                value and ends somewhere inside the interval range.
-                         */
-
-                        lNode->left = newRight;
+                        perror( input );
                 }
-                else if ( lNode->left <= newLeft && newRight == lNode->right )
+                else
                 {
-                        /*
-                                Case 3: [newLeft, newRight) starts somwhere inside the 
-                                interval range and ends at the node's right value.
-                         */
-
-                        lNode->right = newLeft;
+                        interval_set_print( is );
+                        interval_set_stats_print( is, stderr );
                 }
-                else if ( lNode->left < newLeft && newRight < lNode->right )
-                {
-                        /*
-                                Case 4: [newLeft, newRight) partially covers the range 
-                                of the interval node, in which case it must be
-                                split in to two nodes.
-                         */
 
-                        interval_t*     newNode = ( interval_t* ) calloc( 1, sizeof( interval_t ) );
-
-                        newNode->left = newRight;
-                        newNode->right = lNode->right;
-
-                        lNode->right = newLeft;
-                        newNode->next = lNode->next;
-                        
-                        if ( lNode->next )
-                        {
-                                lNode->next->prev = newNode;
-                        }
-                        else
+                if ( log )
+                {
+                        if ( status == 0 && interval_set_checkpoint( is, state, log ) < 0 )
                         {
-                                is->tail = newNode;
+                                perror( state );
+                                status = -1;
                         }
 
-                        lNode->next = newNode;
+                        interval_log_close( log );
+                        free( stateLog );
                 }
-        }
-        
-        if ( should_print )
-        {
-                interval_set_print( is );
-        }
-}
 
-int
-main( int argc, char** argv )
-{
+                interval_set_free( is );
 
-        size_t                  bufSize = 1024;
-        char*                   buf = ( char* ) malloc( bufSize );
-        interval_set_t*         is = ( interval_set_t* ) calloc( 1, sizeof( interval_set_t ) );
+                return status < 0 ? 1 : 0;
+        }
+
+        buf = ( char* ) malloc( bufSize );
         
         while (1)
         {
@@ -694,18 +9113,39 @@ main( int argc, char** argv )
                 int                     leftArg = atoi( strtok( NULL, " " ) );
                 int                     rightArg = atoi( strtok( NULL, " " ) );
 
+                if ( log && ( strcmp( operationArg, "A" ) == 0 || strcmp( operationArg, "R" ) == 0 ) )
+                {
+                        interval_log_append( log, operationArg[0], leftArg, rightArg );
+
+                        if ( interval_log_sync( log ) < 0 )
+                        {
+                                perror( stateLog );
+                        }
+                }
+
                 if ( strcmp( operationArg, "A" ) == 0 )
                 {
-                        interval_set_add( is, leftArg, rightArg, SHOULD_PRINT );
+                        interval_set_add( is, leftArg, rightArg, changes ? SHOULD_NOT_PRINT : SHOULD_PRINT );
                 }
                 else if ( strcmp( operationArg, "R" ) == 0 )
                 {
-                        interval_set_remove( is, leftArg, rightArg, SHOULD_PRINT );
+                        interval_set_remove( is, leftArg, rightArg, changes ? SHOULD_NOT_PRINT : SHOULD_PRINT );
                 }
 
                 memset( buf, 0, bufSize );
         }
 
+        if ( log )
+        {
+                if ( interval_set_checkpoint( is, state, log ) < 0 )
+                {
+                        perror( state );
+                }
+
+                interval_log_close( log );
+                free( stateLog );
+        }
+
         interval_set_free( is );
 
         free( buf );
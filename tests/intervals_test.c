@@ -0,0 +1,1688 @@
+/*
+
+Differential tests for intervals_solution.c.
+
+Each part of the API is driven with random operations, and the result is
+compared against a plain bitmap of the key space after each step. The
+solution is included whole ( with its main renamed ), so the tests can also
+walk internal structures such as snapshot treaps.
+
+        gcc -O2 -pthread -o intervals_test tests/intervals_test.c
+        ./intervals_test [seed] [rounds]
+
+Building with -DINTERVAL_THREADS=8 -DINTERVAL_MIN_PER_THREAD=64 forces the
+parallel paths even on a single core machine.
+
+*/
+
+
+#define main interval_solution_main
+#include "../intervals_solution.c"
+#undef main
+
+#define TEST_CHECK( condition ) \
+        do \
+        { \
+                if ( !( condition ) ) \
+                { \
+                        fprintf( stderr, "%s:%d: check failed: %s ( seed %lu )\n", __FILE__, __LINE__, #condition, test_seed ); \
+                        exit( 1 ); \
+                } \
+        } while ( 0 )
+
+/*
+        How test_backends applies its operations: directly, through the
+        deferred queue, or through cursor hints.
+ */
+
+#define TEST_EAGER 0
+#define TEST_DEFERRED 1
+#define TEST_HINTED 2
+
+static unsigned long    test_seed;
+
+/*
+        The backends and modes the set tests run through.
+ */
+
+static const int        test_backend_kinds[] =
+{
+        INTERVAL_BACKEND_LIST,
+        INTERVAL_BACKEND_ARRAY,
+        INTERVAL_BACKEND_BLOCK,
+        INTERVAL_BACKEND_HYBRID,
+};
+
+static const int        test_modes[] =
+{
+        TEST_EAGER,
+        TEST_DEFERRED,
+        TEST_HINTED,
+};
+
+#define TEST_BACKENDS ( sizeof( test_backend_kinds ) / sizeof( test_backend_kinds[0] ) )
+#define TEST_MODES ( sizeof( test_modes ) / sizeof( test_modes[0] ) )
+
+/*
+        The reference model: one bit per value of [base, base + width).
+        Operations never leave that range, so everything outside it is out
+        of the set.
+ */
+
+typedef struct
+{
+        uint64_t*       bits;
+        int             base;
+        int             width;
+} test_model_t;
+
+/*
+        Intervals of a set or of the model, in order.
+ */
+
+typedef struct
+{
+        int*            lefts;
+        int*            rights;
+        size_t          count;
+        size_t          capacity;
+} test_list_t;
+
+static uint64_t
+test_random( uint64_t* rng )
+{
+        *rng ^= *rng << 13;
+        *rng ^= *rng >> 7;
+        *rng ^= *rng << 17;
+
+        return *rng;
+}
+
+static int
+test_below( uint64_t* rng, int n )
+{
+        return ( int ) ( test_random( rng ) % ( uint64_t ) n );
+}
+
+static void
+test_model_init( test_model_t* m, int base, int width )
+{
+        m->bits = ( uint64_t* ) calloc( width / 64 + 1, sizeof( uint64_t ) );
+        m->base = base;
+        m->width = width;
+}
+
+static void
+test_model_free( test_model_t* m )
+{
+        free( m->bits );
+}
+
+static void
+test_model_copy( test_model_t* to, const test_model_t* from )
+{
+        test_model_init( to, from->base, from->width );
+        memcpy( to->bits, from->bits, ( from->width / 64 + 1 ) * sizeof( uint64_t ) );
+}
+
+static void
+test_model_fill( test_model_t* m, int left, int right, int value )
+{
+        /*
+                Sets or clears [left, right), a word at a time.
+         */
+
+        for ( int x = left - m->base; x < right - m->base; )
+        {
+                int             n = 64 - ( x & 63 ) < right - m->base - x ? 64 - ( x & 63 ) : right - m->base - x;
+                uint64_t        mask = ( n == 64 ? ~0ull : ( 1ull << n ) - 1 ) << ( x & 63 );
+
+                if ( value )
+                {
+                        m->bits[x >> 6] |= mask;
+                }
+                else
+                {
+                        m->bits[x >> 6] &= ~mask;
+                }
+
+                x += n;
+        }
+}
+
+static int
+test_model_get( const test_model_t* m, int x )
+{
+        if ( x < m->base || x - m->base >= m->width )
+        {
+                return 0;
+        }
+
+        return ( m->bits[( x - m->base ) >> 6] >> ( ( x - m->base ) & 63 ) ) & 1;
+}
+
+static int64_t
+test_model_count( const test_model_t* m, int left, int right )
+{
+        /*
+                How many values of [left, right) are set.
+         */
+
+        int64_t         count = 0;
+
+        left = left > m->base ? left : m->base;
+        right = right < m->base + m->width ? right : m->base + m->width;
+
+        for ( int x = left - m->base; x < right - m->base; )
+        {
+                int             n = 64 - ( x & 63 ) < right - m->base - x ? 64 - ( x & 63 ) : right - m->base - x;
+                uint64_t        mask = ( n == 64 ? ~0ull : ( 1ull << n ) - 1 ) << ( x & 63 );
+
+                count += __builtin_popcountll( m->bits[x >> 6] & mask );
+                x += n;
+        }
+
+        return count;
+}
+
+static int
+test_model_any( const test_model_t* m, int left, int right )
+{
+        return test_model_count( m, left, right ) > 0;
+}
+
+static void
+test_list_push( test_list_t* list, int left, int right )
+{
+        if ( list->count == list->capacity )
+        {
+                list->capacity = list->capacity ? list->capacity * 2 : 256;
+                list->lefts = ( int* ) realloc( list->lefts, list->capacity * sizeof( int ) );
+                list->rights = ( int* ) realloc( list->rights, list->capacity * sizeof( int ) );
+        }
+
+        list->lefts[list->count] = left;
+        list->rights[list->count] = right;
+        list->count++;
+}
+
+static void
+test_list_free( test_list_t* list )
+{
+        free( list->lefts );
+        free( list->rights );
+}
+
+static void
+test_model_runs( const test_model_t* m, test_list_t* list )
+{
+        /*
+                The maximal runs of set bits, skipping whole empty or full
+                words.
+         */
+
+        int     x = 0;
+
+        list->count = 0;
+
+        while ( x < m->width )
+        {
+                int     start;
+
+                while ( x < m->width && !( m->bits[x >> 6] >> ( x & 63 ) ) )
+                {
+                        x = ( x | 63 ) + 1;
+                }
+
+                while ( x < m->width && !( ( m->bits[x >> 6] >> ( x & 63 ) ) & 1 ) )
+                {
+                        x++;
+                }
+
+                if ( x >= m->width )
+                {
+                        break;
+                }
+
+                start = x;
+
+                while ( x < m->width && ( ( m->bits[x >> 6] >> ( x & 63 ) ) & 1 ) )
+                {
+                        x = ( x & 63 ) == 0 && m->bits[x >> 6] == ~0ull ? x + 64 : x + 1;
+                }
+
+                test_list_push( list, m->base + start, m->base + ( x < m->width ? x : m->width ) );
+        }
+}
+
+static void
+test_set_runs( interval_set_t* is, test_list_t* list )
+{
+        interval_iter_t         it;
+        int                     left;
+        int                     right;
+
+        list->count = 0;
+        interval_iter_begin( &it, is );
+
+        while ( interval_iter_next( &it, &left, &right ) )
+        {
+                test_list_push( list, left, right );
+        }
+}
+
+static void
+test_pnode_runs( const interval_pnode_t* node, test_list_t* list )
+{
+        if ( node )
+        {
+                test_pnode_runs( node->lchild, list );
+                test_list_push( list, node->left, node->right );
+                test_pnode_runs( node->rchild, list );
+        }
+}
+
+static int
+test_compare_keys( const void* a, const void* b )
+{
+        uint64_t        x = *( const uint64_t* ) a;
+        uint64_t        y = *( const uint64_t* ) b;
+
+        return ( x > y ) - ( x < y );
+}
+
+static void
+test_list_equal( const test_list_t* a, const test_list_t* b )
+{
+        TEST_CHECK( a->count == b->count );
+        TEST_CHECK( !a->count || memcmp( a->lefts, b->lefts, a->count * sizeof( int ) ) == 0 );
+        TEST_CHECK( !a->count || memcmp( a->rights, b->rights, a->count * sizeof( int ) ) == 0 );
+}
+
+static void
+test_set_equal( interval_set_t* is, const test_model_t* m )
+{
+        test_list_t     expected = { 0 };
+        test_list_t     actual = { 0 };
+
+        test_model_runs( m, &expected );
+        test_set_runs( is, &actual );
+        test_list_equal( &expected, &actual );
+        test_list_free( &expected );
+        test_list_free( &actual );
+}
+
+static void
+test_random_range( uint64_t* rng, const test_model_t* m, int* left, int* right )
+{
+        /*
+                Mostly short ranges in a few hot spots, so that the set
+                fragments, with the odd wide one that merges or clears
+                whole stretches of it.
+         */
+
+        int     r = test_below( rng, 100 );
+        int     length;
+
+        if ( r < 80 )
+        {
+                int     spot = test_below( rng, 8 ) * ( m->width / 8 );
+
+                *left = m->base + spot + test_below( rng, m->width / 64 );
+                length = 1 + test_below( rng, 64 );
+        }
+        else if ( r < 97 )
+        {
+                *left = m->base + test_below( rng, m->width );
+                length = 1 + test_below( rng, 4096 );
+        }
+        else
+        {
+                *left = m->base + test_below( rng, m->width );
+                length = 1 + test_below( rng, m->width );
+        }
+
+        *right = length < m->base + m->width - *left ? *left + length : m->base + m->width;
+}
+
+static int
+test_random_point( uint64_t* rng, const test_model_t* m )
+{
+        return m->base - 8 + test_below( rng, m->width + 16 );
+}
+
+static void
+test_queries( interval_set_t* is, const test_model_t* m, uint64_t* rng )
+{
+        /*
+                Checks the read APIs against the model at random points and
+                ranges.
+         */
+
+        test_list_t     runs = { 0 };
+        int             values[64];
+        unsigned char   found[64];
+        int             lefts[16];
+        int             rights[16];
+
+        test_model_runs( m, &runs );
+
+        for ( int i = 0; i < 64; i++ )
+        {
+                values[i] = test_random_point( rng, m );
+                TEST_CHECK( interval_set_contains( is, values[i] ) == test_model_get( m, values[i] ) );
+        }
+
+        interval_set_contains_batch( is, values, 64, found );
+
+        for ( int i = 0; i < 64; i++ )
+        {
+                TEST_CHECK( found[i] == test_model_get( m, values[i] ) );
+        }
+
+        for ( int i = 0; i < 16; i++ )
+        {
+                int             a = test_random_point( rng, m );
+                int             b = a + 1 + test_below( rng, i < 8 ? 128 : m->width );
+                int64_t         covered = test_model_count( m, a, b );
+                size_t          count = 0;
+                int             overlaps = 0;
+                size_t          first = runs.count;
+
+                for ( size_t k = 0; k < runs.count; k++ )
+                {
+                        if ( runs.lefts[k] < b && runs.rights[k] > a )
+                        {
+                                count++;
+                                overlaps = 1;
+                                first = first < k ? first : k;
+                        }
+                }
+
+                TEST_CHECK( interval_set_overlaps( is, a, b ) == overlaps );
+                TEST_CHECK( interval_set_covered( is, a, b ) == covered );
+                TEST_CHECK( interval_set_count_range( is, a, b ) == count );
+
+                /*
+                        read_range, a page at a time.
+                 */
+
+                for ( size_t k = first; ; )
+                {
+                        size_t  n = interval_set_read_range( is, a, b, lefts, rights, 16 );
+
+                        for ( size_t j = 0; j < n; j++, k++ )
+                        {
+                                TEST_CHECK( k < runs.count && lefts[j] == runs.lefts[k] && rights[j] == runs.rights[k] );
+                        }
+
+                        if ( n < 16 )
+                        {
+                                TEST_CHECK( k - first == count );
+                                break;
+                        }
+
+                        a = rights[15];
+                }
+        }
+
+        for ( int i = 0; i < 4; i++ )
+        {
+                size_t  k = runs.count ? ( size_t ) test_below( rng, ( int ) runs.count + 1 ) : 0;
+                int     left;
+                int     right;
+
+                if ( k < runs.count )
+                {
+                        TEST_CHECK( interval_set_kth( is, k, &left, &right ) );
+                        TEST_CHECK( left == runs.lefts[k] && right == runs.rights[k] );
+                }
+                else
+                {
+                        TEST_CHECK( !interval_set_kth( is, k, &left, &right ) );
+                }
+        }
+
+        /*
+                A cursor walks forward a few steps and then back again.
+         */
+
+        for ( int i = 0; i < 4; i++ )
+        {
+                interval_cursor_t       c;
+                int                     x = test_random_point( rng, m );
+                size_t                  k = 0;
+                int                     left;
+                int                     right;
+                int                     steps = test_below( rng, 8 );
+
+                while ( k < runs.count && runs.rights[k] <= x )
+                {
+                        k++;
+                }
+
+                if ( !interval_cursor_seek( &c, is, x, &left, &right ) )
+                {
+                        TEST_CHECK( k == runs.count );
+                        continue;
+                }
+
+                TEST_CHECK( k < runs.count && left == runs.lefts[k] && right == runs.rights[k] );
+
+                for ( int s = 0; s < steps; s++ )
+                {
+                        if ( !interval_cursor_next( &c, &left, &right ) )
+                        {
+                                TEST_CHECK( k + 1 == runs.count );
+                                steps = -1;
+                                break;
+                        }
+
+                        k++;
+                        TEST_CHECK( k < runs.count && left == runs.lefts[k] && right == runs.rights[k] );
+                }
+
+                for ( int s = 0; s <= steps; s++ )
+                {
+                        if ( !interval_cursor_prev( &c, &left, &right ) )
+                        {
+                                TEST_CHECK( k == 0 );
+                                break;
+                        }
+
+                        k--;
+                        TEST_CHECK( left == runs.lefts[k] && right == runs.rights[k] );
+                }
+        }
+
+        test_list_free( &runs );
+}
+
+static void
+test_feed_mirror( const interval_change_t* change, void* context )
+{
+        /*
+                Keeps a copy of the set's intervals, in no particular order,
+                up to date from its change feed. Deletes and resizes must
+                name an interval that is in the copy.
+         */
+
+        test_list_t*    mirror = ( test_list_t* ) context;
+        int             left = change->kind == INTERVAL_CHANGE_RESIZE ? change->oldLeft : change->left;
+        int             right = change->kind == INTERVAL_CHANGE_RESIZE ? change->oldRight : change->right;
+        size_t          k = 0;
+
+        if ( change->kind == INTERVAL_CHANGE_INSERT )
+        {
+                test_list_push( mirror, change->left, change->right );
+                return;
+        }
+
+        while ( k < mirror->count && ( mirror->lefts[k] != left || mirror->rights[k] != right ) )
+        {
+                k++;
+        }
+
+        TEST_CHECK( k < mirror->count );
+
+        if ( change->kind == INTERVAL_CHANGE_DELETE )
+        {
+                mirror->count--;
+                mirror->lefts[k] = mirror->lefts[mirror->count];
+                mirror->rights[k] = mirror->rights[mirror->count];
+        }
+        else
+        {
+                mirror->lefts[k] = change->left;
+                mirror->rights[k] = change->right;
+        }
+}
+
+static void
+test_mirror_equal( const test_list_t* mirror, const test_model_t* m )
+{
+        test_list_t     expected = { 0 };
+        test_list_t     sorted = { 0 };
+        uint64_t*       keys = ( uint64_t* ) malloc( ( mirror->count + 1 ) * sizeof( uint64_t ) );
+        size_t          n = mirror->count;
+
+        for ( size_t k = 0; k < n; k++ )
+        {
+                keys[k] = ( ( uint64_t ) ( ( uint32_t ) mirror->lefts[k] ^ 0x80000000u ) << 32 ) | ( uint32_t ) mirror->rights[k];
+        }
+
+        qsort( keys, n, sizeof( uint64_t ), test_compare_keys );
+
+        for ( size_t k = 0; k < n; k++ )
+        {
+                test_list_push( &sorted, ( int ) ( ( uint32_t ) ( keys[k] >> 32 ) ^ 0x80000000u ), ( int ) ( uint32_t ) keys[k] );
+        }
+
+        test_model_runs( m, &expected );
+        test_list_equal( &expected, &sorted );
+        test_list_free( &expected );
+        test_list_free( &sorted );
+        free( keys );
+}
+
+static void
+test_backends( uint64_t seed, int rounds )
+{
+        /*
+                Random adds and removes on every backend, in every mode,
+                checked against the model as they go.
+         */
+
+        for ( size_t b = 0; b < TEST_BACKENDS; b++ )
+        {
+                for ( size_t k = 0; k < TEST_MODES; k++ )
+                {
+                        int                     backend = test_backend_kinds[b];
+                        int                     mode = test_modes[k];
+                        uint64_t                rng = seed + backend * 3 + mode;
+                        interval_set_t*         is = interval_set_create( backend );
+                        test_model_t            m;
+                        test_list_t             mirror = { 0 };
+                        interval_cursor_t       hint = { 0 };
+
+                        test_model_init( &m, -( 1 << 19 ), 1 << 20 );
+
+                        if ( mode == TEST_DEFERRED )
+                        {
+                                interval_set_defer( is, 1 + test_below( &rng, 32 ) );
+                        }
+
+                        interval_set_feed_callback( is, test_feed_mirror, &mirror );
+
+                        for ( int i = 0; i < rounds; i++ )
+                        {
+                                int     left;
+                                int     right;
+                                int     add = test_below( &rng, 3 ) != 0;
+
+                                test_random_range( &rng, &m, &left, &right );
+
+                                if ( mode == TEST_HINTED && test_below( &rng, 4 ) != 0 )
+                                {
+                                        int     l;
+                                        int     r;
+
+                                        /*
+                                                The hint is kept across the
+                                                plain adds and removes below,
+                                                which leave it stale.
+                                         */
+
+                                        if ( !hint.valid || test_below( &rng, 8 ) == 0 )
+                                        {
+                                                interval_cursor_seek( &hint, is, left, &l, &r );
+                                        }
+
+                                        if ( add )
+                                        {
+                                                interval_set_add_at( is, &hint, left, right );
+                                        }
+                                        else
+                                        {
+                                                interval_set_remove_at( is, &hint, left, right );
+                                        }
+                                }
+                                else if ( add )
+                                {
+                                        interval_set_add( is, left, right, SHOULD_NOT_PRINT );
+                                }
+                                else
+                                {
+                                        interval_set_remove( is, left, right, SHOULD_NOT_PRINT );
+                                }
+
+                                test_model_fill( &m, left, right, add );
+
+                                if ( test_below( &rng, 2000 ) == 0 )
+                                {
+                                        interval_set_clear( is );
+                                        test_model_fill( &m, m.base, m.base + m.width, 0 );
+                                        mirror.count = 0;
+                                }
+
+                                if ( mode == TEST_HINTED && hint.valid && test_below( &rng, 8 ) == 0 )
+                                {
+                                        /*
+                                                A stale cursor searches again
+                                                from its bounds.
+                                         */
+
+                                        interval_cursor_t       c = hint;
+                                        int                     forward = test_below( &rng, 2 );
+                                        int                     x = forward ? hint.right : hint.left - 1;
+                                        int                     expectedLeft;
+                                        int                     expectedRight;
+                                        int                     l;
+                                        int                     r;
+
+                                        interval_set_add( is, left, right, SHOULD_NOT_PRINT );
+                                        test_model_fill( &m, left, right, 1 );
+
+                                        while ( x >= m.base && x < m.base + m.width && !test_model_get( &m, x ) )
+                                        {
+                                                x += forward ? 1 : -1;
+                                        }
+
+                                        if ( x < m.base || x >= m.base + m.width )
+                                        {
+                                                TEST_CHECK( !( forward ? interval_cursor_next( &c, &l, &r ) : interval_cursor_prev( &c, &l, &r ) ) );
+                                        }
+                                        else
+                                        {
+                                                expectedLeft = x;
+                                                expectedRight = x;
+
+                                                while ( test_model_get( &m, expectedLeft - 1 ) )
+                                                {
+                                                        expectedLeft--;
+                                                }
+
+                                                while ( test_model_get( &m, expectedRight ) )
+                                                {
+                                                        expectedRight++;
+                                                }
+
+                                                TEST_CHECK( forward ? interval_cursor_next( &c, &l, &r ) : interval_cursor_prev( &c, &l, &r ) );
+                                                TEST_CHECK( l == expectedLeft && r == expectedRight );
+                                        }
+                                }
+
+                                if ( i % 64 == 0 || i == rounds - 1 )
+                                {
+                                        test_set_equal( is, &m );
+                                        test_queries( is, &m, &rng );
+                                        test_mirror_equal( &mirror, &m );
+                                }
+                        }
+
+                        interval_set_free( is );
+                        test_model_free( &m );
+                        test_list_free( &mirror );
+                }
+        }
+}
+
+static int
+test_wide_value( uint64_t* rng )
+{
+        /*
+                A value anywhere in the key space, mostly on or right next to
+                a chunk boundary of the hybrid backend.
+         */
+
+        int64_t value = ( int64_t ) test_below( rng, 1 << 16 ) << INTERVAL_CHUNK_BITS;
+
+        if ( test_below( rng, 4 ) == 0 )
+        {
+                value += test_below( rng, INTERVAL_CHUNK_SIZE );
+        }
+        else
+        {
+                value += test_below( rng, 3 ) - 1;
+        }
+
+        if ( value < 1 )
+        {
+                value = 1;
+        }
+        else if ( value > 0xFFFFFFFFll )
+        {
+                value = 0xFFFFFFFFll;
+        }
+
+        return ( int ) ( value - 2147483648LL );
+}
+
+static void
+test_wide( uint64_t seed, int rounds )
+{
+        /*
+                Ranges across the whole key space on the hybrid backend,
+                against the list backend, so that runs of full chunks are
+                merged, split and cut into. The hybrid set must stay within
+                three chunks per interval.
+         */
+
+        uint64_t                rng = seed + 50;
+        interval_set_t*         list = interval_set_create( INTERVAL_BACKEND_LIST );
+        interval_set_t*         hybrid = interval_set_create( INTERVAL_BACKEND_HYBRID );
+        test_list_t             expected = { 0 };
+        test_list_t             actual = { 0 };
+
+        for ( int i = 0; i < rounds; i++ )
+        {
+                int     left = test_wide_value( &rng );
+                int     right = test_wide_value( &rng );
+                int     x = test_wide_value( &rng );
+                int     l[2];
+                int     r[2];
+                int     found[2];
+
+                if ( left == right )
+                {
+                        continue;
+                }
+
+                if ( left > right )
+                {
+                        int     t = left;
+
+                        left = right;
+                        right = t;
+                }
+
+                if ( test_below( &rng, 5 ) < 3 )
+                {
+                        interval_set_add( list, left, right, SHOULD_NOT_PRINT );
+                        interval_set_add( hybrid, left, right, SHOULD_NOT_PRINT );
+                }
+                else
+                {
+                        interval_set_remove( list, left, right, SHOULD_NOT_PRINT );
+                        interval_set_remove( hybrid, left, right, SHOULD_NOT_PRINT );
+                }
+
+                test_set_runs( list, &expected );
+                test_set_runs( hybrid, &actual );
+                test_list_equal( &expected, &actual );
+                TEST_CHECK( hybrid->chunks.count <= 3 * expected.count );
+
+                TEST_CHECK( interval_set_contains( list, x ) == interval_set_contains( hybrid, x ) );
+                TEST_CHECK( interval_set_overlaps( list, left, right ) == interval_set_overlaps( hybrid, left, right ) );
+
+                for ( int k = 0; k < 2; k++ )
+                {
+                        interval_cursor_t       c;
+
+                        found[k] = interval_cursor_seek( &c, k ? hybrid : list, x, &l[k], &r[k] );
+
+                        if ( found[k] && interval_cursor_prev( &c, &l[k], &r[k] ) )
+                        {
+                                found[k] = 2;
+                        }
+                }
+
+                TEST_CHECK( found[0] == found[1] );
+                TEST_CHECK( !found[0] || ( l[0] == l[1] && r[0] == r[1] ) );
+        }
+
+        test_list_free( &expected );
+        test_list_free( &actual );
+        interval_set_free( list );
+        interval_set_free( hybrid );
+}
+
+static void
+test_bulk( uint64_t seed, int rounds )
+{
+        /*
+                The bulk paths, each on a set that already holds something
+                ( or built from scratch ), against the same operations
+                applied to the model one at a time.
+         */
+
+        for ( size_t k = 0; k < TEST_BACKENDS; k++ )
+        {
+                int                     backend = test_backend_kinds[k];
+                uint64_t                rng = seed + 100 + backend;
+                size_t                  n = ( size_t ) rounds * 4;
+                interval_op_t*          ops = ( interval_op_t* ) malloc( n * sizeof( interval_op_t ) );
+                int*                    lefts = ( int* ) malloc( n * sizeof( int ) );
+                int*                    rights = ( int* ) malloc( n * sizeof( int ) );
+                interval_set_t*         batch = interval_set_create( backend );
+                interval_set_t*         replay = interval_set_create( backend );
+                interval_set_t*         built;
+                test_model_t            m;
+                test_list_t             mirror = { 0 };
+
+                test_model_init( &m, -( 1 << 19 ), 1 << 20 );
+
+                for ( int i = 0; i < 256; i++ )
+                {
+                        int     left;
+                        int     right;
+
+                        test_random_range( &rng, &m, &left, &right );
+                        interval_set_add( batch, left, right, SHOULD_NOT_PRINT );
+                        interval_set_add( replay, left, right, SHOULD_NOT_PRINT );
+                        test_model_fill( &m, left, right, 1 );
+                }
+
+                test_set_runs( replay, &mirror );
+                interval_set_feed_callback( replay, test_feed_mirror, &mirror );
+
+                for ( size_t i = 0; i < n; i++ )
+                {
+                        test_random_range( &rng, &m, &ops[i].left, &ops[i].right );
+                        ops[i].kind = test_below( &rng, 3 ) ? INTERVAL_OP_ADD : INTERVAL_OP_REMOVE;
+                        test_model_fill( &m, ops[i].left, ops[i].right, ops[i].kind == INTERVAL_OP_ADD );
+                }
+
+                interval_set_apply_batch( batch, ops, n );
+                test_set_equal( batch, &m );
+                interval_set_replay_ops( replay, ops, n );
+                test_set_equal( replay, &m );
+                test_mirror_equal( &mirror, &m );
+
+                /*
+                        from_array, with overlapping and touching intervals in
+                        random order.
+                 */
+
+                test_model_fill( &m, m.base, m.base + m.width, 0 );
+
+                for ( size_t i = 0; i < n; i++ )
+                {
+                        test_random_range( &rng, &m, &lefts[i], &rights[i] );
+
+                        if ( test_below( &rng, 8 ) == 0 )
+                        {
+                                rights[i] = lefts[i];
+                        }
+
+                        test_model_fill( &m, lefts[i], rights[i], 1 );
+                }
+
+                built = interval_set_from_array( backend, lefts, rights, n );
+                test_set_equal( built, &m );
+
+                interval_set_free( built );
+                interval_set_free( batch );
+                interval_set_free( replay );
+                test_list_free( &mirror );
+                test_model_free( &m );
+                free( ops );
+                free( lefts );
+                free( rights );
+        }
+}
+
+static void
+test_combine( uint64_t seed, int rounds )
+{
+        /*
+                Union, intersection, difference and complement of random sets,
+                bit by bit against the models.
+         */
+
+        for ( size_t k = 0; k < TEST_BACKENDS; k++ )
+        {
+                int                     backend = test_backend_kinds[k];
+                uint64_t                rng = seed + 200 + backend;
+                interval_set_t*         a = interval_set_create( backend );
+                interval_set_t*         b = interval_set_create( backend );
+                interval_set_t*         result;
+                test_model_t            ma;
+                test_model_t            mb;
+                test_model_t            expected;
+                int                     lo;
+                int                     hi;
+
+                test_model_init( &ma, -( 1 << 19 ), 1 << 20 );
+                test_model_init( &mb, ma.base, ma.width );
+                test_model_init( &expected, ma.base, ma.width );
+
+                for ( int i = 0; i < rounds; i++ )
+                {
+                        int     left;
+                        int     right;
+                        int     add = test_below( &rng, 3 ) != 0;
+
+                        test_random_range( &rng, &ma, &left, &right );
+
+                        if ( i % 2 )
+                        {
+                                add ? interval_set_add( a, left, right, SHOULD_NOT_PRINT ) : interval_set_remove( a, left, right, SHOULD_NOT_PRINT );
+                                test_model_fill( &ma, left, right, add );
+                        }
+                        else
+                        {
+                                add ? interval_set_add( b, left, right, SHOULD_NOT_PRINT ) : interval_set_remove( b, left, right, SHOULD_NOT_PRINT );
+                                test_model_fill( &mb, left, right, add );
+                        }
+                }
+
+                for ( int kind = 0; kind < 4; kind++ )
+                {
+                        lo = ma.base + test_below( &rng, ma.width / 2 );
+                        hi = lo + test_below( &rng, ma.width / 2 );
+
+                        for ( int w = 0; w <= ma.width / 64; w++ )
+                        {
+                                uint64_t        x = ma.bits[w];
+                                uint64_t        y = mb.bits[w];
+
+                                expected.bits[w] = kind == 0 ? x | y : kind == 1 ? x & y : kind == 2 ? x & ~y : ~x;
+                        }
+
+                        if ( kind == 3 )
+                        {
+                                test_model_fill( &expected, ma.base, lo, 0 );
+                                test_model_fill( &expected, hi, ma.base + ma.width, 0 );
+                        }
+
+                        result = kind == 0 ? interval_set_union( a, b ) :
+                                        kind == 1 ? interval_set_intersect( a, b ) :
+                                        kind == 2 ? interval_set_difference( a, b ) :
+                                        interval_set_complement( a, lo, hi );
+
+                        test_set_equal( result, &expected );
+                        interval_set_free( result );
+                }
+
+                interval_set_free( a );
+                interval_set_free( b );
+                test_model_free( &ma );
+                test_model_free( &mb );
+                test_model_free( &expected );
+        }
+}
+
+/*
+        Reader threads of the concurrent set check that every snapshot they
+        take is sorted and disjoint while the writer keeps changing it.
+ */
+
+typedef struct
+{
+        interval_set_concurrent_t*      ic;
+        atomic_int*                     stop;
+        unsigned long                   snapshots;
+} test_reader_t;
+
+static void*
+test_reader( void* argument )
+{
+        test_reader_t*          reader = ( test_reader_t* ) argument;
+        int                     slot = interval_set_concurrent_register( reader->ic );
+        test_list_t             runs = { 0 };
+
+        TEST_CHECK( slot >= 0 );
+
+        while ( !atomic_load( reader->stop ) )
+        {
+                interval_snapshot_t     snapshot = interval_set_concurrent_read_begin( reader->ic, slot );
+
+                runs.count = 0;
+                test_pnode_runs( snapshot.root, &runs );
+
+                for ( size_t k = 0; k < runs.count; k++ )
+                {
+                        TEST_CHECK( runs.lefts[k] < runs.rights[k] );
+                        TEST_CHECK( k == 0 || runs.rights[k - 1] < runs.lefts[k] );
+                }
+
+                interval_set_concurrent_read_end( reader->ic, slot );
+                reader->snapshots++;
+        }
+
+        interval_set_concurrent_unregister( reader->ic, slot );
+        test_list_free( &runs );
+
+        return NULL;
+}
+
+static void
+test_concurrent( uint64_t seed, int rounds )
+{
+        uint64_t                        rng = seed + 300;
+        interval_set_concurrent_t*      ic = interval_set_concurrent_create();
+        test_reader_t                   readers[2];
+        pthread_t                       threads[2];
+        atomic_int                      stop = 0;
+        test_model_t                    m;
+        test_list_t                     expected = { 0 };
+        test_list_t                     actual = { 0 };
+        int                             slot = interval_set_concurrent_register( ic );
+
+        test_model_init( &m, -( 1 << 15 ), 1 << 16 );
+
+        for ( int t = 0; t < 2; t++ )
+        {
+                readers[t].ic = ic;
+                readers[t].stop = &stop;
+                readers[t].snapshots = 0;
+                pthread_create( &threads[t], NULL, test_reader, &readers[t] );
+        }
+
+        for ( int i = 0; i < rounds; i++ )
+        {
+                int     left;
+                int     right;
+                int     add = test_below( &rng, 3 ) != 0;
+
+                test_random_range( &rng, &m, &left, &right );
+                add ? interval_set_concurrent_add( ic, left, right ) : interval_set_concurrent_remove( ic, left, right );
+                test_model_fill( &m, left, right, add );
+
+                if ( i % 16 == 0 || i == rounds - 1 )
+                {
+                        interval_snapshot_t     snapshot = interval_set_concurrent_read_begin( ic, slot );
+                        int                     x = test_random_point( &rng, &m );
+
+                        actual.count = 0;
+                        test_pnode_runs( snapshot.root, &actual );
+                        test_model_runs( &m, &expected );
+                        test_list_equal( &expected, &actual );
+                        TEST_CHECK( interval_snapshot_contains( snapshot, x ) == test_model_get( &m, x ) );
+                        TEST_CHECK( interval_snapshot_overlaps( snapshot, x, x + 100 ) == test_model_any( &m, x, x + 100 ) );
+                        interval_set_concurrent_read_end( ic, slot );
+                }
+        }
+
+        atomic_store( &stop, 1 );
+
+        for ( int t = 0; t < 2; t++ )
+        {
+                pthread_join( threads[t], NULL );
+        }
+
+        interval_set_concurrent_unregister( ic, slot );
+        interval_set_concurrent_free( ic );
+        test_model_free( &m );
+        test_list_free( &expected );
+        test_list_free( &actual );
+}
+
+static void
+test_versioned( uint64_t seed, int rounds )
+{
+        /*
+                Every version keeps its own model. Old versions are released
+                at random, some while a snapshot of them is still held, and
+                the survivors are read back.
+         */
+
+        uint64_t                        rng = seed + 400;
+        interval_set_versioned_t*       vs = interval_set_versioned_create();
+        test_model_t*                   models = ( test_model_t* ) calloc( rounds + 1, sizeof( test_model_t ) );
+        test_list_t                     expected = { 0 };
+        test_list_t                     actual = { 0 };
+        interval_snapshot_t             held = { 0 };
+        unsigned long                   heldVersion = 0;
+        int                             holding = 0;
+
+        test_model_init( &models[0], -( 1 << 13 ), 1 << 14 );
+
+        for ( int i = 1; i <= rounds; i++ )
+        {
+                unsigned long           version;
+                interval_snapshot_t     snapshot;
+                int                     left;
+                int                     right;
+                int                     add = test_below( &rng, 3 ) != 0;
+
+                test_random_range( &rng, &models[0], &left, &right );
+                version = add ? interval_set_versioned_add( vs, left, right ) : interval_set_versioned_remove( vs, left, right );
+                TEST_CHECK( version == ( unsigned long ) i && interval_set_versioned_current( vs ) == version );
+
+                test_model_copy( &models[i], &models[i - 1] );
+                test_model_fill( &models[i], left, right, add );
+
+                if ( !holding && i > 1 && test_below( &rng, 8 ) == 0 )
+                {
+                        heldVersion = ( unsigned long ) test_below( &rng, i );
+                        holding = interval_set_versioned_get( vs, heldVersion, &held );
+                }
+
+                if ( test_below( &rng, 2 ) == 0 )
+                {
+                        unsigned long   old = ( unsigned long ) test_below( &rng, i );
+
+                        interval_set_versioned_release( vs, old );
+                        TEST_CHECK( !interval_set_versioned_get( vs, old, &snapshot ) );
+                }
+
+                if ( i % 8 == 0 || i == rounds )
+                {
+                        version = ( unsigned long ) test_below( &rng, i + 1 );
+
+                        if ( interval_set_versioned_get( vs, version, &snapshot ) )
+                        {
+                                actual.count = 0;
+                                test_pnode_runs( snapshot.root, &actual );
+                                test_model_runs( &models[version], &expected );
+                                test_list_equal( &expected, &actual );
+                                interval_set_versioned_put( snapshot );
+                        }
+                }
+
+                if ( holding && test_below( &rng, 16 ) == 0 )
+                {
+                        actual.count = 0;
+                        test_pnode_runs( held.root, &actual );
+                        test_model_runs( &models[heldVersion], &expected );
+                        test_list_equal( &expected, &actual );
+                        interval_set_versioned_put( held );
+                        holding = 0;
+                }
+        }
+
+        if ( holding )
+        {
+                interval_set_versioned_put( held );
+        }
+
+        interval_set_versioned_free( vs );
+
+        /*
+                Releasing each version once the next one exists keeps the
+                slot array at its initial size.
+         */
+
+        vs = interval_set_versioned_create();
+
+        for ( int i = 1; i <= 4096; i++ )
+        {
+                interval_snapshot_t     snapshot;
+                unsigned long           version = interval_set_versioned_add( vs, i, i + 1 );
+
+                TEST_CHECK( version == ( unsigned long ) i );
+                interval_set_versioned_release( vs, version - 1 );
+                TEST_CHECK( !interval_set_versioned_get( vs, version - 1, &snapshot ) );
+                TEST_CHECK( interval_set_versioned_get( vs, version, &snapshot ) );
+                interval_set_versioned_put( snapshot );
+        }
+
+        TEST_CHECK( vs->capacity == 64 );
+        interval_set_versioned_free( vs );
+
+        for ( int i = 0; i <= rounds; i++ )
+        {
+                test_model_free( &models[i] );
+        }
+
+        free( models );
+        test_list_free( &expected );
+        test_list_free( &actual );
+}
+
+/*
+        Writer threads of the sharded set, each on its own quarter of the
+        key space. Quarters span two shards, so some operations lock both.
+ */
+
+typedef struct
+{
+        interval_set_sharded_t*         ss;
+        test_model_t                    slice;
+        uint64_t                        rng;
+        int                             rounds;
+} test_writer_t;
+
+static void*
+test_writer( void* argument )
+{
+        test_writer_t*          writer = ( test_writer_t* ) argument;
+
+        for ( int i = 0; i < writer->rounds; i++ )
+        {
+                int     left;
+                int     right;
+                int     add = test_below( &writer->rng, 3 ) != 0;
+
+                test_random_range( &writer->rng, &writer->slice, &left, &right );
+                add ? interval_set_sharded_add( writer->ss, left, right ) : interval_set_sharded_remove( writer->ss, left, right );
+                test_model_fill( &writer->slice, left, right, add );
+        }
+
+        return NULL;
+}
+
+static void
+test_sharded_collect( int left, int right, void* context )
+{
+        test_list_push( ( test_list_t* ) context, left, right );
+}
+
+static void
+test_sharded( uint64_t seed, int rounds )
+{
+        for ( size_t k = 0; k < TEST_BACKENDS; k++ )
+        {
+                int                             backend = test_backend_kinds[k];
+                uint64_t                        rng = seed + 500 + backend;
+                test_model_t                    m;
+                interval_set_sharded_t*         ss;
+                test_writer_t                   writers[4];
+                pthread_t                       threads[4];
+                test_list_t                     expected = { 0 };
+                test_list_t                     actual = { 0 };
+
+                test_model_init( &m, -( 1 << 17 ), 1 << 18 );
+                ss = interval_set_sharded_create( backend, 8, m.base, m.base + m.width );
+
+                for ( int t = 0; t < 4; t++ )
+                {
+                        writers[t].ss = ss;
+                        writers[t].slice.bits = m.bits + t * ( m.width / 4 / 64 );
+                        writers[t].slice.base = m.base + t * ( m.width / 4 );
+                        writers[t].slice.width = m.width / 4;
+                        writers[t].rng = rng + t;
+                        writers[t].rounds = rounds;
+                        pthread_create( &threads[t], NULL, test_writer, &writers[t] );
+                }
+
+                for ( int t = 0; t < 4; t++ )
+                {
+                        pthread_join( threads[t], NULL );
+                }
+
+                for ( int phase = 0; phase < 2; phase++ )
+                {
+                        actual.count = 0;
+                        interval_set_sharded_foreach( ss, test_sharded_collect, &actual );
+                        test_model_runs( &m, &expected );
+                        test_list_equal( &expected, &actual );
+
+                        for ( int i = 0; i < 256; i++ )
+                        {
+                                int     x = test_random_point( &rng, &m );
+
+                                TEST_CHECK( interval_set_sharded_contains( ss, x ) == test_model_get( &m, x ) );
+                        }
+
+                        /*
+                                Move the boundaries, then keep writing across
+                                the whole key space.
+                         */
+
+                        interval_set_sharded_rebalance( ss );
+
+                        for ( int i = 0; i < rounds; i++ )
+                        {
+                                int     left;
+                                int     right;
+                                int     add = test_below( &rng, 3 ) != 0;
+
+                                test_random_range( &rng, &m, &left, &right );
+                                add ? interval_set_sharded_add( ss, left, right ) : interval_set_sharded_remove( ss, left, right );
+                                test_model_fill( &m, left, right, add );
+                        }
+                }
+
+                interval_set_sharded_free( ss );
+                test_model_free( &m );
+                test_list_free( &expected );
+                test_list_free( &actual );
+        }
+}
+
+static void
+test_shared_equal( const interval_shared_t* sh, const test_model_t* m, uint64_t* rng )
+{
+        for ( int x = m->base - 2; x < m->base + m->width + 2; x++ )
+        {
+                TEST_CHECK( interval_shared_contains( sh, x ) == test_model_get( m, x ) );
+        }
+
+        for ( int i = 0; i < 64; i++ )
+        {
+                int     a = test_random_point( rng, m );
+                int     b = a + 1 + test_below( rng, 256 );
+
+                TEST_CHECK( interval_shared_overlaps( sh, a, b ) == test_model_any( m, a, b ) );
+        }
+}
+
+static void
+test_shared( uint64_t seed, int rounds )
+{
+        /*
+                The writer and a read-only mapping of the same segment. The
+                small capacity makes some adds and removes run out of nodes,
+                and those must leave the set as it was.
+         */
+
+        uint64_t                rng = seed + 600;
+        char                    name[64];
+        interval_shared_t       writer;
+        interval_shared_t       reader;
+        test_model_t            m;
+        int                     full = 0;
+        interval_text_t         text = { 0 };
+        uint32_t                stack[512];
+        char                    expected[8192];
+        size_t                  written = 0;
+
+        snprintf( name, sizeof( name ), "/interval_test_%d", ( int ) getpid() );
+        test_model_init( &m, -( 1 << 12 ), 1 << 13 );
+
+        TEST_CHECK( interval_shared_create( &writer, name, 128 ) == 0 );
+        TEST_CHECK( interval_shared_attach( &reader, name ) == 0 );
+
+        for ( int i = 0; i < rounds; i++ )
+        {
+                int     left;
+                int     right;
+                int     add = test_below( &rng, 2 ) != 0;
+                int     result;
+
+                /*
+                        Short ranges only, so that the set outgrows the
+                        segment.
+                 */
+
+                left = m.base + test_below( &rng, m.width - 16 );
+                right = left + 1 + test_below( &rng, 16 );
+                result = add ? interval_shared_add( &writer, left, right ) : interval_shared_remove( &writer, left, right );
+
+                if ( result < 0 )
+                {
+                        TEST_CHECK( errno == ENOSPC );
+                        full++;
+                }
+                else
+                {
+                        test_model_fill( &m, left, right, add );
+                }
+
+                if ( i % 32 == 0 || i == rounds - 1 )
+                {
+                        test_shared_equal( &reader, &m, &rng );
+                }
+        }
+
+        TEST_CHECK( full > 0 );
+
+        /*
+                Creating the segment again replaces it. The reader keeps the
+                old one, and a new reader sees the new, empty set.
+         */
+
+        interval_shared_detach( &writer );
+        TEST_CHECK( interval_shared_create( &writer, name, 128 ) == 0 );
+        test_shared_equal( &reader, &m, &rng );
+        interval_shared_detach( &reader );
+
+        TEST_CHECK( interval_shared_attach( &reader, name ) == 0 );
+        test_model_fill( &m, m.base, m.base + m.width, 0 );
+        test_shared_equal( &reader, &m, &rng );
+
+        interval_shared_detach( &reader );
+        interval_shared_detach( &writer );
+
+        /*
+                A treap far deeper than random priorities would make: a chain
+                of nodes, each the left child of the next, written in by
+                hand. Formatting it must still succeed.
+         */
+
+        TEST_CHECK( interval_shared_create( &writer, name, 512 ) == 0 );
+
+        for ( uint32_t node = 1; node <= 300; node++ )
+        {
+                writer.nodes[node].left = ( int ) node * 4;
+                writer.nodes[node].right = ( int ) node * 4 + 2;
+                writer.nodes[node].lchild = node - 1;
+                writer.nodes[node].rchild = 0;
+                snprintf( expected + written, sizeof( expected ) - written, "%s[%d, %d)", node > 1 ? ", " : "{", ( int ) node * 4, ( int ) node * 4 + 2 );
+                written += strlen( expected + written );
+        }
+
+        snprintf( expected + written, sizeof( expected ) - written, "}\n" );
+        writer.header->root = 300;
+        writer.header->count = 300;
+        writer.header->used = 300;
+
+        TEST_CHECK( interval_shared_attach( &reader, name ) == 0 );
+        TEST_CHECK( interval_shared_format( &reader, interval_shared_read_begin( &reader ), &text, stack, reader.header->capacity ) );
+        TEST_CHECK( text.length == strlen( expected ) && memcmp( text.data, expected, text.length ) == 0 );
+        TEST_CHECK( interval_shared_contains( &reader, 4 ) && !interval_shared_contains( &reader, 6 ) );
+
+        free( text.data );
+        interval_shared_detach( &reader );
+        interval_shared_detach( &writer );
+        TEST_CHECK( interval_shared_unlink( name ) == 0 );
+        test_model_free( &m );
+}
+
+static void
+test_persist( uint64_t seed, int rounds )
+{
+        /*
+                Snapshot, log, reload and checkpoint.
+         */
+
+        for ( size_t k = 0; k < TEST_BACKENDS; k++ )
+        {
+                int                     backend = test_backend_kinds[k];
+                uint64_t                rng = seed + 700 + backend;
+                char                    snapshot[64];
+                char                    logPath[64];
+                interval_set_t*         is = interval_set_create( backend );
+                interval_set_t*         loaded;
+                interval_log_t*         log;
+                interval_image_t        image;
+                test_model_t            m;
+
+                snprintf( snapshot, sizeof( snapshot ), "/tmp/interval_test_%d.snap", ( int ) getpid() );
+                snprintf( logPath, sizeof( logPath ), "/tmp/interval_test_%d.log", ( int ) getpid() );
+                unlink( snapshot );
+                unlink( logPath );
+                test_model_init( &m, -( 1 << 19 ), 1 << 20 );
+
+                for ( int phase = 0; phase < 3; phase++ )
+                {
+                        log = interval_log_open( logPath );
+                        TEST_CHECK( log );
+
+                        for ( int i = 0; i < rounds; i++ )
+                        {
+                                int     left;
+                                int     right;
+                                int     add = test_below( &rng, 3 ) != 0;
+
+                                test_random_range( &rng, &m, &left, &right );
+                                TEST_CHECK( interval_log_append( log, add ? INTERVAL_OP_ADD : INTERVAL_OP_REMOVE, left, right ) == 0 );
+                                add ? interval_set_add( is, left, right, SHOULD_NOT_PRINT ) : interval_set_remove( is, left, right, SHOULD_NOT_PRINT );
+                                test_model_fill( &m, left, right, add );
+                        }
+
+                        TEST_CHECK( interval_log_sync( log ) == 0 );
+
+                        loaded = interval_set_load( backend, snapshot, logPath );
+                        TEST_CHECK( loaded );
+                        test_set_equal( loaded, &m );
+                        interval_set_free( loaded );
+
+                        TEST_CHECK( interval_set_checkpoint( is, snapshot, log ) == 0 );
+                        TEST_CHECK( interval_log_close( log ) == 0 );
+
+                        TEST_CHECK( interval_image_open( &image, snapshot ) == 0 );
+
+                        for ( int i = 0; i < 256; i++ )
+                        {
+                                int     x = test_random_point( &rng, &m );
+
+                                TEST_CHECK( interval_image_contains( &image, x ) == test_model_get( &m, x ) );
+                        }
+
+                        interval_image_close( &image );
+                }
+
+                unlink( snapshot );
+                unlink( logPath );
+                interval_set_free( is );
+                test_model_free( &m );
+        }
+}
+
+/*
+        Interval map payloads: 64 bytes, every int set to the mapped value.
+ */
+
+#define TEST_PAYLOAD_INTS 16
+
+typedef struct
+{
+        int             values[TEST_PAYLOAD_INTS];
+} test_payload_t;
+
+typedef struct
+{
+        const interval_map_t*   map;
+        test_list_t             list;
+} test_map_walk_t;
+
+static void
+test_map_collect( int left, int right, const void* payload, void* context )
+{
+        /*
+                Intervals come in order, and touching ones differ.
+         */
+
+        test_map_walk_t*        walk = ( test_map_walk_t* ) context;
+        test_list_t*            list = &walk->list;
+
+        TEST_CHECK( !list->count || list->rights[list->count - 1] <= left );
+        TEST_CHECK( !list->count || list->rights[list->count - 1] < left ||
+                        memcmp( interval_map_get( walk->map, left - 1 ), payload, sizeof( test_payload_t ) ) != 0 );
+
+        test_list_push( list, left, right );
+}
+
+static void
+test_map( uint64_t seed, int rounds )
+{
+        /*
+                The model maps every value of the key space to an int, 0 for
+                unmapped. Every mapped interval must be a maximal run of one
+                value, as equal touching intervals are merged.
+         */
+
+        uint64_t                rng = seed + 800;
+        interval_map_t*         map = interval_map_create( sizeof( test_payload_t ) );
+        test_model_t            range;
+        int*                    model;
+        int                     base = -( 1 << 12 );
+        int                     width = 1 << 13;
+        test_map_walk_t         walk = { map, { 0 } };
+
+        test_model_init( &range, base, width );
+        model = ( int* ) calloc( width, sizeof( int ) );
+
+        for ( int i = 0; i < rounds; i++ )
+        {
+                test_payload_t  payload;
+                int             left;
+                int             right;
+                int             value = test_below( &rng, 4 );
+
+                test_random_range( &rng, &range, &left, &right );
+
+                for ( int k = 0; k < TEST_PAYLOAD_INTS; k++ )
+                {
+                        payload.values[k] = value;
+                }
+
+                if ( test_below( &rng, 4 ) == 0 )
+                {
+                        /*
+                                Assign a payload straight out of the map,
+                                from a node the assignment may free.
+                         */
+
+                        int                     x = base + test_below( &rng, width );
+                        const test_payload_t*   found = ( const test_payload_t* ) interval_map_get( map, x );
+
+                        if ( found )
+                        {
+                                value = found->values[0];
+                                interval_map_assign( map, left, right, found );
+                        }
+                        else
+                        {
+                                value = 0;
+                                interval_map_erase( map, left, right );
+                        }
+                }
+                else if ( value )
+                {
+                        interval_map_assign( map, left, right, &payload );
+                }
+                else
+                {
+                        interval_map_erase( map, left, right );
+                }
+
+                for ( int x = left; x < right; x++ )
+                {
+                        model[x - base] = value;
+                }
+
+                if ( i % 32 == 0 || i == rounds - 1 )
+                {
+                        size_t  runs = 0;
+
+                        for ( int x = base - 2; x < base + width + 2; x++ )
+                        {
+                                int                     expected = x >= base && x < base + width ? model[x - base] : 0;
+                                const test_payload_t*   found;
+                                int                     l;
+                                int                     r;
+
+                                found = ( const test_payload_t* ) interval_map_find( map, x, &l, &r );
+                                TEST_CHECK( !found == !expected );
+
+                                if ( !found )
+                                {
+                                        continue;
+                                }
+
+                                TEST_CHECK( l <= x && x < r && l >= base && r <= base + width );
+                                TEST_CHECK( l == base || model[l - 1 - base] != expected );
+                                TEST_CHECK( r == base + width || model[r - base] != expected );
+
+                                for ( int k = 0; k < TEST_PAYLOAD_INTS; k++ )
+                                {
+                                        TEST_CHECK( found->values[k] == expected );
+                                }
+
+                                runs += l == x;
+                        }
+
+                        walk.list.count = 0;
+                        interval_map_foreach( map, test_map_collect, &walk );
+                        TEST_CHECK( walk.list.count == runs && map->count == runs );
+                }
+        }
+
+        test_list_free( &walk.list );
+        interval_map_free( map );
+        test_model_free( &range );
+        free( model );
+}
+
+int
+main( int argc, char** argv )
+{
+        int     rounds = argc > 2 ? atoi( argv[2] ) : 4000;
+
+        test_seed = argc > 1 ? strtoul( argv[1], NULL, 10 ) : 88172645463325252ul;
+
+        if ( !test_seed )
+        {
+                test_seed = 1;
+        }
+
+        test_backends( test_seed, rounds );
+        test_wide( test_seed, rounds );
+        test_bulk( test_seed, rounds );
+        test_combine( test_seed, rounds );
+        test_concurrent( test_seed, rounds );
+        test_versioned( test_seed, rounds / 4 );
+        test_sharded( test_seed, rounds );
+        test_shared( test_seed, rounds );
+        test_persist( test_seed, rounds / 4 );
+        test_map( test_seed, rounds );
+
+        printf( "ok ( seed %lu, %d rounds, %d threads )\n", test_seed, rounds, interval_thread_count( ( size_t ) -1 ) );
+
+        return 0;
+}